@@ -36,6 +36,7 @@
 #include <sstream>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 namespace {
 
@@ -138,18 +139,24 @@ int TimeToDepthSuite() {
     depths.push_back(depth);
   }
   Time start = now();
+  long total_nodes = 0;
   for (unsigned int t = 0; t < boards.size(); t++) {
     Time test_start = now();
     search::DepthSearch(boards[t], depths[t]);
     Time test_end = now();
     auto test_time = std::chrono::duration_cast<Milliseconds>(test_end-test_start);
-    std::cout << "test " << t << " completed in " << test_time.count() << std::endl;
+    long nodes = search::get_last_search_nodes();
+    total_nodes += nodes;
+    std::cout << "test " << t << " completed in " << test_time.count()
+        << " nodes " << nodes << std::endl;
     search::clear_killers();
+    search::clear_history();
     table::ClearTable();
   }
   Time end = now();
   auto total_time = std::chrono::duration_cast<Milliseconds>(end-start);
-  std::cout << "all tests completed in " << total_time.count() << std::endl;
+  std::cout << "all tests completed in " << total_time.count() << " nodes " << total_nodes
+      << " nps " << (total_nodes * 1000 / std::max<long>(total_time.count(), 1)) << std::endl;
   return total_time.count();
 }
 
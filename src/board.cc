@@ -35,6 +35,7 @@
 #include <iostream>
 #include <array>
 #include <cassert>
+#include <algorithm>
 
 namespace hash {
 
@@ -73,6 +74,18 @@ inline HashType get_color_hash() {
   return color_hash;
 }
 
+HashType GetKeysSignature() {
+  HashType signature = color_hash;
+  for (Color color = kWhite; color <= kBlack; color++) {
+    for (PieceType piece_type = kPawn; piece_type < kNumPieceTypes; piece_type++) {
+      for (Square square = 0; square < 64; square++) {
+        signature = signature * 0x9E3779B97F4A7C15ULL + pieces[color][piece_type][square];
+      }
+    }
+  }
+  return signature;
+}
+
 }
 
 namespace {
@@ -141,7 +154,7 @@ int32_t GetFiftyMoveCount(const MoveHistoryInformation info) {
 }
 
 template<int Quiescent>
-void AddMoves(std::vector<Move> &move_list, Square source_square, BitBoard destinations,
+void AddMoves(MoveList &move_list, Square source_square, BitBoard destinations,
     BitBoard enemy_pieces) {
   BitBoard captures = destinations & enemy_pieces;
   BitBoard regulars = destinations ^ captures;
@@ -160,34 +173,25 @@ void AddMoves(std::vector<Move> &move_list, Square source_square, BitBoard desti
 }
 
 template<int Quiescent, int MoveGenType, int PieceType>
-void AddMoves(std::vector<Move> &moves, std::vector<Move> &legal_moves, BitBoard piece_bitboard,
-    const BitBoard own_pieces, const BitBoard enemy_pieces,
-    const BitBoard all_pieces, const BitBoard critical) {
-  if (MoveGenType == kNormalMoveGen) {
-    BitBoard not_pinned = piece_bitboard & ~critical;
-    piece_bitboard ^= not_pinned;
-    while (not_pinned) {
-      Square piece_square = bitops::NumberOfTrailingZeros(not_pinned);
-      BitBoard destinations = magic::GetAttackMap<PieceType>(piece_square, all_pieces);
-      destinations &= ~own_pieces;
-      AddMoves<Quiescent>(legal_moves, piece_square, destinations, enemy_pieces);
-      bitops::PopLSB(not_pinned);
-    }
-  }
+void AddMoves(MoveList &moves, MoveList &legal_moves, BitBoard piece_bitboard,
+    const BitBoard targets, const BitBoard enemy_pieces, const BitBoard all_pieces,
+    const BitBoard pinned, const Square king_square) {
+  //Without any pins or checks around the king all moves are legal anyway.
+  MoveList &move_list = MoveGenType == kFastMoveGen ? moves : legal_moves;
   while (piece_bitboard) {
     Square piece_square = bitops::NumberOfTrailingZeros(piece_bitboard);
-    BitBoard destinations = magic::GetAttackMap<PieceType>(piece_square, all_pieces);
-    if (MoveGenType == kInCheckMoveGen) {
-      destinations &= critical;
+    BitBoard destinations = magic::GetAttackMap<PieceType>(piece_square, all_pieces) & targets;
+    //Pinned pieces may only move along the line through their king.
+    if (pinned & GetSquareBitBoard(piece_square)) {
+      destinations &= magic::GetLine(king_square, piece_square);
     }
-    destinations &= ~own_pieces;
-    AddMoves<Quiescent>(moves, piece_square, destinations, enemy_pieces);
+    AddMoves<Quiescent>(move_list, piece_square, destinations, enemy_pieces);
     bitops::PopLSB(piece_bitboard);
   }
 }
 
 template<int Quiescent>
-inline void AddPromotionMoves(const Square src, const Square des, std::vector<Move> &moves) {
+inline void AddPromotionMoves(const Square src, const Square des, MoveList &moves) {
   moves.emplace_back(GetMove(src, des, kQueenPromotion));
   moves.emplace_back(GetMove(src, des, kKnightPromotion));
   if (Quiescent == kNonQuiescent) {
@@ -198,7 +202,7 @@ inline void AddPromotionMoves(const Square src, const Square des, std::vector<Mo
 
 template<int Quiescent, int MoveGenType, int PointOfView>
 inline void ConditionalAddPromotionMoves(const Square src, const Square des,
-                                         std::vector<Move> &moves, const MoveType move_type) {
+                                         MoveList &moves, const MoveType move_type) {
   const int back_rank = PointOfView == kWhite ? 7 : 0;
   if (MoveGenType >= kNormalMoveGen || GetSquareY(des) != back_rank) {
     moves.emplace_back(GetMove(src, des, move_type));
@@ -209,7 +213,7 @@ inline void ConditionalAddPromotionMoves(const Square src, const Square des,
 }
 
 inline void AddNonPromotionMovesLoop(BitBoard &des, const Square square_dif,
-                             std::vector<Move> &moves, const MoveType move_type) {
+                             MoveList &moves, const MoveType move_type) {
   while (des) {
     const Square destination = bitops::NumberOfTrailingZeros(des);
     moves.emplace_back(GetMove(destination - square_dif, destination, move_type));
@@ -219,7 +223,7 @@ inline void AddNonPromotionMovesLoop(BitBoard &des, const Square square_dif,
 
 template<int Quiescent, int MoveGenType, int PointOfView>
 inline void AddPawnMovesLoop(BitBoard &des, const Square square_dif,
-                             std::vector<Move> &moves, const MoveType move_type) {
+                             MoveList &moves, const MoveType move_type) {
   while (des) {
     const Square destination = bitops::NumberOfTrailingZeros(des);
     ConditionalAddPromotionMoves<Quiescent, MoveGenType, PointOfView>(
@@ -231,7 +235,7 @@ inline void AddPawnMovesLoop(BitBoard &des, const Square square_dif,
 template<int Quiescent, int MoveGenType, Color PointOfView>
 inline void AddPawnMoves(const BitBoard pawn_bb, const BitBoard empty,
                          const BitBoard enemy_pieces, const Square en_passant,
-                         std::vector<Move> &moves, const BitBoard critical) {
+                         MoveList &moves, const BitBoard critical) {
   const BitBoard double_push_row = PointOfView == kWhite ? fourth_row : fifth_row;
   const int f_east = PointOfView == kWhite ? kNorthEast : kSouthEast;
   const int f_west = PointOfView == kWhite ? kNorthWest : kSouthWest;
@@ -607,7 +611,55 @@ void Board::Make(const Move move) {
   move_history_information.emplace_back(information);
   move_history.emplace_back(move);
   SwapTurn();
-  search::inc_node_count();
+}
+
+HashType Board::GetHashAfterMove(const Move move) const {
+  HashType new_hash = hash ^ hash::get_color_hash();
+  CastlingRights new_castling_rights = castling_rights;
+  Square new_en_passant = 56 - (56 * get_turn());
+  if (!settings::kUseNullMoves || move != kNullMove) {
+    const Square source = GetMoveSource(move);
+    const Square destination = GetMoveDestination(move);
+    const Piece piece = pieces[source];
+    if (GetPieceType(pieces[destination]) != kNoPiece) {
+      new_hash ^= hash::get_piece(pieces[destination], destination);
+    }
+    new_hash ^= hash::get_piece(piece, source) ^ hash::get_piece(piece, destination);
+    switch (GetMoveType(move)) {
+    case kDoublePawnMove:
+      new_en_passant = destination - 8 + (2*8) * get_turn();
+      break;
+    case kCastle:
+      if (destination < source) {
+        new_hash ^= hash::get_piece(get_turn(), kRook, source - 4)
+                  ^ hash::get_piece(get_turn(), kRook, source - 1);
+      }
+      else {
+        new_hash ^= hash::get_piece(get_turn(), kRook, source + 3)
+                  ^ hash::get_piece(get_turn(), kRook, source + 1);
+      }
+      break;
+    case kEnPassant:
+      new_hash ^= hash::get_piece(get_not_turn(), kPawn, destination - 8 + (2*8) * get_turn());
+      break;
+    default:
+      if (GetMoveType(move) >= kKnightPromotion) {
+        new_hash ^= hash::get_piece(piece, destination)
+                  ^ hash::get_piece(get_turn(), GetMoveType(move) - kKnightPromotion + kKnight,
+                                    destination);
+      }
+      break;
+    }
+    BitBoard srcdes = GetSquareBitBoard(source) | GetSquareBitBoard(destination);
+    if (srcdes & all_castling_squares) {
+      for (int right = 0; right < 4; right++) {
+        if (castling_relevant_bbs[right] & srcdes) {
+          new_castling_rights &= ~(0x1 << right);
+        }
+      }
+    }
+  }
+  return new_hash ^ (new_castling_rights | GetSquareBitBoard(new_en_passant));
 }
 
 void Board::UnMake() {
@@ -720,76 +772,76 @@ BitBoard Board::PlayerBitBoardControl(Color color, BitBoard all_pieces) const {
 }
 
 template<int Quiescent, int MoveGenType>
-std::vector<Move> Board::GetMoves(const BitBoard critical) {
-  std::vector<Move> moves;
-  std::vector<Move> legal_moves;
-
-  const int expected_num_moves = Quiescent == kQuiescent ? 16 : 48;
-  if (MoveGenType == kInCheckMoveGen) {
-    legal_moves.reserve(expected_num_moves / 4);
-    moves.reserve(expected_num_moves / 2);
-  }
-  else if (MoveGenType == kFastMoveGen) {
-    moves.reserve(expected_num_moves);
-  }
-  else {
-    legal_moves.reserve(expected_num_moves);
-    moves.reserve(expected_num_moves);
-  }
+MoveList Board::GetMoves(const BitBoard pinned, const BitBoard checkers) const {
+  //Pieces other than pawns are only ever added to the list of legal moves, so
+  //all moves are added to the same list unless we use the fast move gen.
+  MoveList moves;
+  MoveList legal_moves;
 
   const BitBoard own_pieces = color_bitboards[get_turn()];
   const BitBoard enemy_pieces = color_bitboards[get_not_turn()];
   const BitBoard all_pieces = own_pieces | enemy_pieces;
   const BitBoard empty = ~all_pieces;
-  AddMoves<Quiescent, MoveGenType, kKnight>(moves, legal_moves,
-      get_piece_bitboard(get_turn(), kKnight), own_pieces, enemy_pieces,
-      all_pieces, critical);
-  AddMoves<Quiescent, MoveGenType, kBishop>(moves, legal_moves,
-      get_piece_bitboard(get_turn(), kBishop), own_pieces, enemy_pieces,
-      all_pieces, critical);
-  AddMoves<Quiescent, MoveGenType, kRook>(moves, legal_moves,
-      get_piece_bitboard(get_turn(), kRook), own_pieces, enemy_pieces,
-      all_pieces, critical);
-  AddMoves<Quiescent, MoveGenType, kQueen>(moves, legal_moves,
-      get_piece_bitboard(get_turn(), kQueen), own_pieces, enemy_pieces,
-      all_pieces, critical);
-
-  //Pawns
-  if (get_turn() == kWhite) {
-    AddPawnMoves<Quiescent, MoveGenType, kWhite>(
-        get_piece_bitboard(kWhite, kPawn), empty, enemy_pieces, en_passant, moves, critical);
-  }
-  else {
-    AddPawnMoves<Quiescent, MoveGenType, kBlack>(
-        get_piece_bitboard(kBlack, kPawn), empty, enemy_pieces, en_passant, moves, critical);
+  const BitBoard king_bitboard = get_piece_bitboard(get_turn(), kKing);
+  const Square king_square = bitops::NumberOfTrailingZeros(king_bitboard);
+
+  //In check, other pieces have to capture the checker or block its ray. In
+  //double check only the king may move.
+  BitBoard targets = ~own_pieces;
+  if (MoveGenType == kInCheckMoveGen) {
+    targets = checkers | magic::GetSquaresBetween(king_square,
+                                                  bitops::NumberOfTrailingZeros(checkers));
+  }
+  if (MoveGenType != kInCheckMoveGen || !(checkers & (checkers - 1))) {
+    AddMoves<Quiescent, MoveGenType, kKnight>(moves, legal_moves,
+        get_piece_bitboard(get_turn(), kKnight), targets, enemy_pieces,
+        all_pieces, pinned, king_square);
+    AddMoves<Quiescent, MoveGenType, kBishop>(moves, legal_moves,
+        get_piece_bitboard(get_turn(), kBishop), targets, enemy_pieces,
+        all_pieces, pinned, king_square);
+    AddMoves<Quiescent, MoveGenType, kRook>(moves, legal_moves,
+        get_piece_bitboard(get_turn(), kRook), targets, enemy_pieces,
+        all_pieces, pinned, king_square);
+    AddMoves<Quiescent, MoveGenType, kQueen>(moves, legal_moves,
+        get_piece_bitboard(get_turn(), kQueen), targets, enemy_pieces,
+        all_pieces, pinned, king_square);
+
+    //Pawns
+    if (get_turn() == kWhite) {
+      AddPawnMoves<Quiescent, MoveGenType, kWhite>(
+          get_piece_bitboard(kWhite, kPawn), empty, enemy_pieces, en_passant, moves, targets);
+    }
+    else {
+      AddPawnMoves<Quiescent, MoveGenType, kBlack>(
+          get_piece_bitboard(kBlack, kPawn), empty, enemy_pieces, en_passant, moves, targets);
+    }
   }
 
-  //King
-  BitBoard king = get_piece_bitboard(get_turn(), kKing);
-  const Square king_square = bitops::NumberOfTrailingZeros(king);
+  //King. Squares behind the king on the ray of a checking slider are still
+  //attacked once the king moves, so the king is removed from the occupancy.
+  BitBoard king = king_bitboard;
   king |= bitops::E(king) | bitops::W(king);
   king |= bitops::N(king) | bitops::S(king);
-  BitBoard in_check = PlayerBitBoardControl(get_not_turn(), all_pieces);
+  BitBoard in_check = PlayerBitBoardControl(get_not_turn(), all_pieces ^ king_bitboard);
   king &= ~(own_pieces | in_check);
-  if (MoveGenType != kNormalMoveGen) {
+  if (MoveGenType == kFastMoveGen) {
     AddMoves<Quiescent>(moves, king_square, king, enemy_pieces);
   }
   else {
     AddMoves<Quiescent>(legal_moves, king_square, king, enemy_pieces);
   }
-  if (!Quiescent) {
+  if (!Quiescent && MoveGenType != kInCheckMoveGen) {
     // Add castling moves
     for (int right = 0 + 2*get_turn(); right < 2+2*get_turn(); right++) {
       if ((castling_rights & (0x1 << right))
           && !(castling_check_bbs[right] & in_check)
           && !(castling_empty_bbs[right] & all_pieces)) {
-        Square source = bitops::NumberOfTrailingZeros(get_piece_bitboard(get_turn(), kKing));
-        Square destination = source + 2 - (right%2)*4;
+        Square destination = king_square + 2 - (right%2)*4;
         if (MoveGenType == kNormalMoveGen) {
-          legal_moves.emplace_back(GetMove(source, destination, kCastle));
+          legal_moves.emplace_back(GetMove(king_square, destination, kCastle));
         }
         else {
-          moves.emplace_back(GetMove(source, destination, kCastle));
+          moves.emplace_back(GetMove(king_square, destination, kCastle));
         }
       }
     }
@@ -799,36 +851,31 @@ std::vector<Move> Board::GetMoves(const BitBoard critical) {
     return moves;
   }
 
-  //Now we need to remove illegal moves.
-  BitBoard dangerous_sources = magic::GetAttackMap<kQueen>(king_square, all_pieces)
-      | get_piece_bitboard(get_turn(), kKing);
+  //Now we need to remove illegal pawn moves. Pawn pushes and captures
+  //have already been restricted to evasions if we are in check.
+  const BitBoard enemy_rooks = get_piece_bitboard(get_not_turn(), kRook)
+                             | get_piece_bitboard(get_not_turn(), kQueen);
+  const BitBoard enemy_bishops = get_piece_bitboard(get_not_turn(), kBishop)
+                               | get_piece_bitboard(get_not_turn(), kQueen);
+  const BitBoard enemy_leapers = get_piece_bitboard(get_not_turn(), kKnight)
+                               | get_piece_bitboard(get_not_turn(), kPawn);
   for (Move move : moves) {
-    BitBoard move_src = GetSquareBitBoard(GetMoveSource(move));
+    const Square source = GetMoveSource(move);
+    const BitBoard destination = GetSquareBitBoard(GetMoveDestination(move));
     bool add = false;
-    if (MoveGenType != kInCheckMoveGen) {
-      if (!(dangerous_sources & move_src) && GetMoveType(move) != kEnPassant) {
-        add = true;
-      }
-      else {
-        Make(move);
-        SwapTurn();
-        if (!InCheck()) {
-          add = true;
-        }
-        SwapTurn();
-        UnMake();
-        search::dec_node_count();
-      }
+    if (GetMoveType(move) == kEnPassant) {
+      //En passant removes two pawns from the board at once, which may
+      //uncover an attack on the king along a rank or diagonal. A knight or
+      //pawn giving check has to be the captured pawn.
+      const BitBoard captured = GetSquareBitBoard(GetMoveDestination(move) - 8 + (2*8) * get_turn());
+      const BitBoard occupancy = (all_pieces ^ GetSquareBitBoard(source) ^ captured) | destination;
+      add = !(magic::GetAttackMap<kRook>(king_square, occupancy) & enemy_rooks)
+          && !(magic::GetAttackMap<kBishop>(king_square, occupancy) & enemy_bishops)
+          && !(checkers & enemy_leapers & ~captured);
     }
     else {
-      Make(move);
-      SwapTurn();
-      if (!InCheck()) {
-        add = true;
-      }
-      SwapTurn();
-      UnMake();
-      search::dec_node_count();
+      add = !(pinned & GetSquareBitBoard(source))
+          || (magic::GetLine(king_square, source) & destination);
     }
     if (add) {
       if (GetPieceType(pieces[GetMoveSource(move)]) == kPawn
@@ -847,7 +894,7 @@ std::vector<Move> Board::GetMoves(const BitBoard critical) {
 }
 
 template<int Quiescent>
-std::vector<Move> Board::GetMoves() {
+MoveList Board::GetMoves() const {
   Square king_square = bitops::NumberOfTrailingZeros(get_piece_bitboard(get_turn(), kKing));
   BitBoard danger = magic::GetAttackMap<kKnight>(king_square, 0) & get_piece_bitboard(get_not_turn(), kKnight);
   danger |= magic::GetAttackMap<kRook>(king_square, 0)
@@ -861,52 +908,49 @@ std::vector<Move> Board::GetMoves() {
     return GetMoves<Quiescent, kFastMoveGen>();
   }
 
+  const BitBoard own_pieces = color_bitboards[get_turn()];
+  const BitBoard enemy_pieces = color_bitboards[get_not_turn()];
+  const BitBoard all_pieces = own_pieces | enemy_pieces;
+  const BitBoard enemy_rooks = get_piece_bitboard(get_not_turn(), kRook)
+                             | get_piece_bitboard(get_not_turn(), kQueen);
+  const BitBoard enemy_bishops = get_piece_bitboard(get_not_turn(), kBishop)
+                               | get_piece_bitboard(get_not_turn(), kQueen);
 
-  danger = magic::GetAttackMap<kKnight>(king_square, 0) & get_piece_bitboard(get_not_turn(), kKnight);
+  BitBoard checkers = magic::GetAttackMap<kKnight>(king_square, 0)
+      & get_piece_bitboard(get_not_turn(), kKnight);
   BitBoard king = get_piece_bitboard(get_turn(), kKing);
   if (get_turn() == kWhite) {
-    danger |= (bitops::NE(king) | bitops::NW(king)) & enemy_pawns;
+    checkers |= (bitops::NE(king) | bitops::NW(king)) & enemy_pawns;
   }
   else {
-    danger |= (bitops::SE(king) | bitops::SW(king)) & enemy_pawns;
-  }
-  if (danger) {
-    return GetMoves<kNonQuiescent, kInCheckMoveGen>(danger);
-  }
-
-  BitBoard own_pieces = color_bitboards[get_turn()];
-  BitBoard enemy_pieces = color_bitboards[get_not_turn()];
-  BitBoard all_pieces = own_pieces | enemy_pieces;
-
-  danger |= magic::GetAttackMap<kRook>(king_square, all_pieces)
-      & (get_piece_bitboard(get_not_turn(), kRook) | get_piece_bitboard(get_not_turn(), kQueen));
-  if (danger) {
-    return GetMoves<kNonQuiescent, kInCheckMoveGen>(
-        magic::GetAttackMap<kRook>(king_square, all_pieces));
+    checkers |= (bitops::SE(king) | bitops::SW(king)) & enemy_pawns;
+  }
+  checkers |= magic::GetAttackMap<kRook>(king_square, all_pieces) & enemy_rooks;
+  checkers |= magic::GetAttackMap<kBishop>(king_square, all_pieces) & enemy_bishops;
+
+  //A piece is pinned if it is the only piece between the king and an enemy
+  //slider which would otherwise attack the king.
+  BitBoard pinned = 0;
+  BitBoard pinners = (magic::GetAttackMap<kRook>(king_square, enemy_pieces) & enemy_rooks)
+    | (magic::GetAttackMap<kBishop>(king_square, enemy_pieces) & enemy_bishops);
+  pinners &= ~checkers;
+  while (pinners) {
+    const Square pinner = bitops::NumberOfTrailingZeros(pinners);
+    const BitBoard blockers = magic::GetSquaresBetween(king_square, pinner) & all_pieces;
+    if (!(blockers & (blockers - 1))) {
+      pinned |= blockers;
+    }
+    bitops::PopLSB(pinners);
   }
-  danger |= magic::GetAttackMap<kBishop>(king_square, all_pieces)
-      & (get_piece_bitboard(get_not_turn(), kBishop) | get_piece_bitboard(get_not_turn(), kQueen));
 
-  if (danger) {
-    return GetMoves<kNonQuiescent, kInCheckMoveGen>(
-        magic::GetAttackMap<kBishop>(king_square, all_pieces));
-  }
-  BitBoard possibly_pinned = 0;
-  const BitBoard rook_attacks = magic::GetAttackMap<kRook>(king_square, 0);
-  if (rook_attacks & (get_piece_bitboard(get_not_turn(), kRook)
-                    | get_piece_bitboard(get_not_turn(), kQueen))) {
-    possibly_pinned |= rook_attacks & own_pieces;
+  if (checkers) {
+    return GetMoves<kNonQuiescent, kInCheckMoveGen>(pinned, checkers);
   }
-  const BitBoard bishop_attacks = magic::GetAttackMap<kBishop>(king_square, 0);
-  if (bishop_attacks & (get_piece_bitboard(get_not_turn(), kBishop)
-                    | get_piece_bitboard(get_not_turn(), kQueen))) {
-    possibly_pinned |= bishop_attacks & own_pieces;
-  }
-  return GetMoves<Quiescent, kNormalMoveGen>(possibly_pinned);
+  return GetMoves<Quiescent, kNormalMoveGen>(pinned);
 }
 
-template std::vector<Move> Board::GetMoves<kNonQuiescent>();
-template std::vector<Move> Board::GetMoves<kQuiescent>();
+template MoveList Board::GetMoves<kNonQuiescent>() const;
+template MoveList Board::GetMoves<kQuiescent>() const;
 
 bool Board::InCheck() const {
   BitBoard bitBoard = get_piece_bitboard(get_turn(), kKing);
@@ -1016,22 +1060,85 @@ bool Board::NonNegativeSEE(const Move move) const {
 }
 
 bool Board::IsMoveLegal(const Move move) const {
-  debug::Error("Use of not yet implemented function Board::IsMoveLegal");
   if (move == kNullMove) {
     return false;
   }
-  Piece piece = get_piece(GetMoveSource(move));
+  const Square source = GetMoveSource(move);
+  const Square destination = GetMoveDestination(move);
+  const MoveType move_type = GetMoveType(move);
+  const Piece piece = pieces[source];
   if (GetPieceType(piece) == kNoPiece || GetPieceColor(piece) != get_turn()) {
     return false;
   }
-  switch (GetMoveType(move)) {
-    case kEnPassant:
-      if (en_passant != GetMoveDestination(move) || GetPieceType(piece) != kPawn) {
+  //Castling and en passant are rare enough to simply look them up.
+  if (move_type == kCastle || move_type == kEnPassant) {
+    MoveList moves = GetMoves<kNonQuiescent>();
+    return std::find(moves.begin(), moves.end(), move) != moves.end();
+  }
+  const Piece target = pieces[destination];
+  const bool capture = GetPieceType(target) != kNoPiece;
+  if (capture && (GetPieceColor(target) == get_turn() || GetPieceType(target) == kKing)) {
+    return false;
+  }
+  const BitBoard all_pieces = get_all_pieces();
+  const BitBoard destination_bb = GetSquareBitBoard(destination);
+  const PieceType piece_type = GetPieceType(piece);
+  if (piece_type == kPawn) {
+    const int forward = get_turn() == kWhite ? 1 : -1;
+    const int dx = GetSquareX(destination) - GetSquareX(source);
+    const int dy = GetSquareY(destination) - GetSquareY(source);
+    const bool promotion = GetSquareY(destination) == (get_turn() == kWhite ? 7 : 0);
+    if (promotion != (move_type >= kKnightPromotion)) {
+      return false;
+    }
+    if (dx == 0 && dy == forward) {
+      if (capture || (move_type != kNormalMove && !promotion)) {
         return false;
       }
-      return true;
+    }
+    else if (dx == 0 && dy == 2 * forward) {
+      if (move_type != kDoublePawnMove || capture
+          || GetSquareY(source) != (get_turn() == kWhite ? 1 : 6)
+          || (all_pieces & GetSquareBitBoard(source + 8 * forward))) {
+        return false;
+      }
+    }
+    else if ((dx == 1 || dx == -1) && dy == forward) {
+      if (!capture || (move_type != kCapture && !promotion)) {
+        return false;
+      }
+    }
+    else {
+      return false;
+    }
   }
-  return true;
+  else {
+    if (move_type != (capture ? kCapture : kNormalMove)) {
+      return false;
+    }
+    BitBoard attacks = piece_type == kKing ? magic::GetAttackMap<kKing>(source, all_pieces)
+                                           : magic::GetAttackMap(piece_type, source, all_pieces);
+    if (!(attacks & destination_bb)) {
+      return false;
+    }
+  }
+
+  //The move is pseudo legal, so it is legal unless it leaves our king attacked.
+  const BitBoard occupancy = (all_pieces ^ GetSquareBitBoard(source)) | destination_bb;
+  const BitBoard enemies = color_bitboards[get_not_turn()] & ~destination_bb;
+  const BitBoard king_bb = piece_type == kKing ? destination_bb
+                                               : get_piece_bitboard(get_turn(), kKing);
+  const Square king_square = bitops::NumberOfTrailingZeros(king_bb);
+  BitBoard pawn_attacks = get_turn() == kWhite ? bitops::NE(king_bb) | bitops::NW(king_bb)
+                                               : bitops::SE(king_bb) | bitops::SW(king_bb);
+  BitBoard attackers = (pawn_attacks & pt_bitboards[kPawn])
+      | (magic::GetAttackMap<kKnight>(king_square, occupancy) & pt_bitboards[kKnight])
+      | (magic::GetAttackMap<kKing>(king_square, occupancy) & pt_bitboards[kKing])
+      | (magic::GetAttackMap<kBishop>(king_square, occupancy)
+          & (pt_bitboards[kBishop] | pt_bitboards[kQueen]))
+      | (magic::GetAttackMap<kRook>(king_square, occupancy)
+          & (pt_bitboards[kRook] | pt_bitboards[kQueen]));
+  return !(attackers & enemies);
 }
 
 Vec<BitBoard, 6> Board::GetDirectCheckingSquares() const {
@@ -1100,7 +1207,6 @@ bool Board::GivesCheck(const Move move) {
   Make(move);
   bool gives_check = InCheck();
   UnMake();
-  search::dec_node_count();
   return gives_check;
 }
 
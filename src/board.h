@@ -48,13 +48,16 @@ public:
   void SetBoard(std::vector<std::string> fen_tokens);
   void evaluate_castling_rights(std::string fen_code);
   template<int Quiescent>
-  std::vector<Move> GetMoves();
+  MoveList GetMoves() const;
   void Make(const Move move);
   void UnMake();
   void SetStartBoard();
   HashType get_hash() const {
     return hash ^ (castling_rights | GetSquareBitBoard(en_passant));
   }
+  //Returns the hash the board would have after making the move, without
+  //making it. Used to prefetch transposition table entries.
+  HashType GetHashAfterMove(const Move move) const;
   //This needs to be public for the evaluation function.
   //PieceBitboardSet get_piece_bitboards() const;
   Piece get_piece(const Square square) const { return pieces[square]; }
@@ -78,8 +81,10 @@ public:
   }
   CastlingRights get_castling_rights() const { return castling_rights; }
   int get_phase() const { return phase; }
-  //Print unicode chess board.
+  //Checks whether a move from an arbitrary source, such as the hash table or
+  //the killers of a sibling node, is legal in this position.
   bool IsMoveLegal(const Move move) const;
+  //Print unicode chess board.
   bool IsDraw() const;
   std::vector<std::string> GetFen() const;
   void Print() const;
@@ -111,7 +116,7 @@ public:
 
 private:
   template<int Quiescent, int MoveGenerationType>
-  std::vector<Move> GetMoves(BitBoard critical = 0);
+  MoveList GetMoves(const BitBoard pinned = 0, const BitBoard checkers = 0) const;
   bool InTwoFoldRepetition() const;
   void SwapTurn();
   void AddPiece(const Square square, const Piece piece);
@@ -139,6 +144,12 @@ private:
   int32_t fifty_move_count;
 };
 
-#include "search.h"
+namespace hash {
+
+//Combines all Zobrist keys into one value, so stored hashes can be checked
+//against the keys of the current build.
+HashType GetKeysSignature();
+
+}
 
 #endif /* BOARD_H_ */
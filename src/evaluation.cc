@@ -25,6 +25,7 @@
  */
 
 #include "evaluation.h"
+#include "search.h"
 #include "learning/linear_algebra.h"
 #include "learning/statistics.h"
 #include "benchmark.h"
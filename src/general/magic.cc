@@ -159,6 +159,7 @@ const std::array<std::array<BitBoard, 64>, 64> generateAttackVectorMaps() {
         BitBoard des = 1;
         int j = 0;
         while (des) {
+            attackVectorMap[i][j] = 0;
             if (des & bitops::N(bitops::FillNorth(src, ~des))) attackVectorMap[i][j] = bitops::N(bitops::FillNorth(src, ~des));
             else if (des & bitops::NE(bitops::FillNorthEast(src, ~des))) attackVectorMap[i][j] = bitops::NE(bitops::FillNorthEast(src, ~des));
             else if (des & bitops::E(bitops::FillEast(src, ~des))) attackVectorMap[i][j] = bitops::E(bitops::FillEast(src, ~des));
@@ -281,6 +282,31 @@ const std::array<BitBoard, 64> initKingSafetyMap() {
 const std::array<std::array<int, 64>, 64> distance_map = initDistMap();
 const std::array<BitBoard, 64> kingSafetyMap = initKingSafetyMap();
 const std::array<std::array<BitBoard, 64>, 64> attackVectorMap = generateAttackVectorMaps();
+
+//The line through two aligned squares extends to the edges of the board in
+//both directions. Squares which are not aligned have an empty line.
+const std::array<std::array<BitBoard, 64>, 64> generateLineMaps() {
+  std::array<std::array<BitBoard, 64>, 64> line_map;
+  for (Square a = 0; a < 64; a++) {
+    for (Square b = 0; b < 64; b++) {
+      line_map[a][b] = 0;
+      if (a == b || !attackVectorMap[a][b]) {
+        continue;
+      }
+      line_map[a][b] = GetSquareBitBoard(a);
+      for (Square c = 0; c < 64; c++) {
+        if ((attackVectorMap[a][c] & GetSquareBitBoard(b))
+            || (attackVectorMap[a][b] & GetSquareBitBoard(c))
+            || (attackVectorMap[c][b] & GetSquareBitBoard(a))) {
+          line_map[a][b] |= GetSquareBitBoard(c);
+        }
+      }
+    }
+  }
+  return line_map;
+}
+
+const std::array<std::array<BitBoard, 64>, 64> lineMap = generateLineMaps();
 const std::array<std::array<BitBoard, (1L << 9)>, 64> bishopMagic = generateBishopAttackMaps();
 const std::array<std::array<BitBoard, (1L << 12)>, 64> rookMagic = generateRookAttackMaps();
 
@@ -338,6 +364,14 @@ BitBoard GetAttackMap(PieceType piece_type, Square square, BitBoard all_pieces)
   }
 }
 
+BitBoard GetSquaresBetween(const Square a, const Square b) {
+  return attackVectorMap[a][b] & ~GetSquareBitBoard(b);
+}
+
+BitBoard GetLine(const Square a, const Square b) {
+  return lineMap[a][b];
+}
+
 int GetSquareDistance(const Square a, const Square b) {
   return distance_map[a][b];
 }
@@ -35,6 +35,11 @@ template<PieceType pt>
 BitBoard GetAttackMap(const int &index, BitBoard AllPieces);
 BitBoard GetAttackVectors(BitBoard src, BitBoard des);
 BitBoard GetAttackMap(PieceType piece_type, Square square, BitBoard all_pieces);
+//Returns the squares strictly between two squares on a common rank, file or
+//diagonal and an empty bitboard otherwise.
+BitBoard GetSquaresBetween(const Square a, const Square b);
+//Returns all squares on the rank, file or diagonal through both squares.
+BitBoard GetLine(const Square a, const Square b);
 int GetSquareDistance(const Square a, const Square b);
 BitBoard GetKingArea(const Square square);
 
@@ -31,6 +31,8 @@
 #include <cstdint>
 #include <chrono>
 #include <array>
+#include <iterator>
+#include <algorithm>
 
 //A bitboard is a 64bit boolean feature representation of the board.
 typedef uint64_t BitBoard;
@@ -102,7 +104,10 @@ const CastlingRights kBLCastle = kWSCastle << 3;
 
 const Score kMaxScore = 100000;
 const Score kMinScore = -kMaxScore;
+//Marks a static evaluation which has not been computed.
+const Score kNoStaticEval = kMinScore - 1;
 
+const int kNoBound = 0;
 const int kLowerBound = 1;
 const int kUpperBound = 2;
 const int kExactBound = kLowerBound | kUpperBound;
@@ -165,5 +170,48 @@ inline BitBoard GetSquareBitBoard(const Square square) {
   return ((BitBoard) 1) << square;
 }
 
+//No legal position has more than 218 moves, so move generation never has to
+//allocate memory.
+const size_t kMaxNumMoves = 256;
+
+//Fixed capacity list of moves with the part of the std::vector interface used
+//by move generation and search. Copies only touch the moves in use.
+class MoveList {
+public:
+  typedef Move *iterator;
+  typedef const Move *const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+
+  MoveList() : num_moves(0) {}
+  MoveList(const MoveList &other) : num_moves(other.num_moves) {
+    std::copy(other.begin(), other.end(), moves);
+  }
+  MoveList &operator=(const MoveList &other) {
+    num_moves = other.num_moves;
+    std::copy(other.begin(), other.end(), moves);
+    return *this;
+  }
+
+  void emplace_back(const Move move) {
+    assert(num_moves < kMaxNumMoves);
+    moves[num_moves++] = move;
+  }
+  void clear() { num_moves = 0; }
+  size_t size() const { return num_moves; }
+  bool empty() const { return num_moves == 0; }
+  Move &operator[](const size_t index) { return moves[index]; }
+  const Move &operator[](const size_t index) const { return moves[index]; }
+  iterator begin() { return moves; }
+  iterator end() { return moves + num_moves; }
+  const_iterator begin() const { return moves; }
+  const_iterator end() const { return moves + num_moves; }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+
+private:
+  Move moves[kMaxNumMoves];
+  size_t num_moves;
+};
+
 
 #endif /* GENERAL_TYPES_H_ */
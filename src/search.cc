@@ -36,9 +36,52 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 using namespace move_features;
 
+namespace {
+class MovePicker;
+}
+
+namespace search {
+
+//Shared state of a node whose remaining moves are searched by several YBWC
+//threads. The move picker and the fields below the mutex are only accessed
+//while holding it. The board must not change while the split point is active.
+struct SplitPoint {
+  SplitPoint *parent;
+  MovePicker *picker;
+  const Board *board;
+  int node_type;
+  Depth depth;
+  Score beta;
+  Score static_eval;
+  //Static evals of this and the previous ply, needed by the improving flag
+  //of descendants.
+  Score static_evals[2];
+  bool in_check;
+  bool improving;
+  size_t ply;
+
+  std::mutex mutex;
+  Score alpha;
+  Move best_move;
+  unsigned int move_number;
+  std::array<Move, kMaxPVLength> pv;
+  size_t pv_length;
+
+  std::atomic<bool> cutoff;
+  //Guarded by the split mutex.
+  int num_slaves;
+};
+
+}
+
 namespace {
 
 const int kPV = 0;
@@ -51,11 +94,6 @@ int kNodeCountSampleAt = 1000;
 int kNodeCountSampleEvalAt = 400;
 const int kMaxDepthSampled = 3;
 
-Board sampled_board;
-Score sampled_alpha;
-int sampled_node_type;
-Depth sampled_depth;
-
 const Vec<Score, 4> init_futility_margins() {
   Vec<Score, 4> kFutilityMargins;
   if (false) {
@@ -75,12 +113,112 @@ const Vec<Score, 4> init_futility_margins() {
 
 const Vec<Score, 4> kFutileMargin = init_futility_margins();
 
+//Captures which cannot raise the stand pat score to alpha even with this much
+//to spare are not searched in quiescent search. Scores are in 1/8 centipawns.
+const Score kDeltaMargin = 200 * 8;
+const Score kDeltaPieceValues[kNumPieceTypes] = { 100 * 8, 300 * 8, 300 * 8, 450 * 8,
+                                                  900 * 8, 0, 0 };
+
+//Late move reductions grow with the logarithm of both depth and move number.
+const int kLMRTableSize = 64;
+const double kLMRBase = 0.25;
+const double kLMRDivisor = 2.0;
+
+const Array2d<Depth, kLMRTableSize, kLMRTableSize> init_lmr_reductions() {
+  Array2d<Depth, kLMRTableSize, kLMRTableSize> reductions;
+  for (int depth = 0; depth < kLMRTableSize; depth++) {
+    for (int move_number = 0; move_number < kLMRTableSize; move_number++) {
+      if (depth == 0 || move_number == 0) {
+        reductions[depth][move_number] = 0;
+        continue;
+      }
+      reductions[depth][move_number] = std::max(0.0, std::round(
+          kLMRBase + std::log(depth) * std::log(move_number) / kLMRDivisor));
+    }
+  }
+  return reductions;
+}
+
+const Array2d<Depth, kLMRTableSize, kLMRTableSize> kLMRReductions = init_lmr_reductions();
+
+//History scores are kept within [-kMaxHistory, kMaxHistory] by scaling them
+//down with every update. They are added to the move weights after division.
+const int32_t kMaxHistory = 16384;
+const int32_t kHistoryDivisor = 32;
+const int32_t kCaptureHistoryDivisor = 512;
+const int32_t kCounterMoveBonus = 150;
+
 std::vector<int> search_weights(kNumMoveProbabilityFeatures);
 
-Array2d<Move, 1024, 2> killers;
-Score last_search_score = 0;
+using search::SearchContext;
+using search::SplitPoint;
+using search::kMaxPVLength;
+
+//The engine's own contexts. The first one is used by the main search thread,
+//the rest by Lazy SMP or YBWC helper threads.
+std::vector<std::unique_ptr<SearchContext> > init_contexts() {
+  std::vector<std::unique_ptr<SearchContext> > contexts;
+  contexts.emplace_back(new SearchContext(0));
+  return contexts;
+}
+
+std::vector<std::unique_ptr<SearchContext> > contexts = init_contexts();
 
 bool print_info = true;
+//Number of best root moves for which exact scores and PVs are reported.
+size_t num_pv_lines = 1;
+
+int smp_mode = search::kLazySMP;
+//Nodes closer to the leaves are not worth the overhead of splitting.
+const Depth kMinSplitDepth = 4;
+const int kMaxSlavesPerSplitPoint = 8;
+//Lazy SMP threads defer moves which another thread is already searching at
+//the same depth to the end of the move loop.
+const Depth kMinDeferDepth = 3;
+//Guards assignments of YBWC workers to split points.
+std::mutex split_mutex;
+std::condition_variable split_condition;
+bool workers_quit = false;
+//Contexts which have a WorkerLoop thread in the current search, guarded by the
+//split mutex. Other contexts must never be assigned to split points.
+std::vector<SearchContext*> ybwc_workers;
+std::atomic<int> num_idle_workers(0);
+//Guards the helper list of the main context, as end_search may be called by
+//another thread while a search is being set up.
+std::mutex helpers_mutex;
+//Every helper context has a thread which is kept alive across searches. The
+//threads sleep until EngineSearch publishes a new search id together with the
+//board and depth to search. All of this is guarded by the pool mutex.
+std::mutex pool_mutex;
+std::condition_variable pool_condition;
+size_t pool_search_id = 0;
+Board pool_board;
+Depth pool_depth = 0;
+size_t num_busy_helpers = 0;
+bool pool_quit = false;
+
+//Helper threads are only started and stopped while no search is running.
+struct HelperThreads {
+  ~HelperThreads() {
+    Stop();
+  }
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      pool_quit = true;
+    }
+    pool_condition.notify_all();
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    pool_quit = false;
+  }
+  std::vector<std::thread> threads;
+};
+
+HelperThreads helper_threads;
 
 struct Sorter {
   bool operator() (Move i, Move j) {
@@ -88,68 +226,165 @@ struct Sorter {
   };
 };
 
-bool SwapToFront(std::vector<Move> &moves, const Move move) {
-  for (int i = 0; i < moves.size(); i++) {
-    if (moves[i] == move) {
-      std::swap(moves[i], moves[0]);
+std::mt19937_64 rng;
+
+inline bool cutoff_occurred(const SplitPoint *split_point) {
+  for (; split_point != nullptr; split_point = split_point->parent) {
+    if (split_point->cutoff.load(std::memory_order_relaxed)) {
       return true;
     }
   }
   return false;
 }
 
-std::mt19937_64 rng;
-size_t max_ply = 0;
-long nodes = 0;
-long sample_nodes = 0;
-long evaluation_nodes = 0;
-
-Time end_time = now();
+//Also true if a beta cutoff made the split point a YBWC thread works on obsolete.
+inline bool finished(const SearchContext &context){
+  return context.stopped.load(std::memory_order_relaxed)
+      || cutoff_occurred(context.split_point);
+}
 
-inline bool finished(){
-  return end_time <= now();
+inline void end_search_time(SearchContext &context) {
+  context.stopped.store(true, std::memory_order_relaxed);
 }
 
-inline void end_search_time() {
-  end_time = now();
+//Must be a power of two. At a million nodes per second the search overshoots
+//its end time by about a millisecond at most.
+const long kNodesPerTimeCheck = 1024;
+
+inline void inc_node_count(SearchContext &context) {
+  const long nodes = context.nodes.load(std::memory_order_relaxed) + 1;
+  context.nodes.store(nodes, std::memory_order_relaxed);
+  if ((nodes & (kNodesPerTimeCheck - 1)) == 0
+      && context.end_time.load(std::memory_order_relaxed) <= now()) {
+    end_search_time(context);
+  }
 }
 
 inline Time get_infinite_time() {
   return now()+std::chrono::hours(24);
 }
 
+inline Depth get_lmr_reduction(const Depth depth, const unsigned int move_number) {
+  return kLMRReductions[std::min(depth, kLMRTableSize - 1)]
+                       [std::min(move_number, (unsigned int) kLMRTableSize - 1)];
+}
+
+inline bool is_quiet(const Move move) {
+  return GetMoveType(move) < kEnPassant;
+}
+
+inline PieceType get_captured_piece_type(const Board &board, const Move move) {
+  if (GetMoveType(move) == kEnPassant) {
+    return kPawn;
+  }
+  return GetPieceType(board.get_piece(GetMoveDestination(move)));
+}
+
+inline int32_t get_history(const SearchContext &context, const Board &board, const Move move) {
+  return context.history[board.get_turn()][GetMoveSource(move)][GetMoveDestination(move)];
+}
+
+inline int32_t get_capture_history(const SearchContext &context, const Board &board,
+                                   const Move move) {
+  return context.capture_history[GetPieceType(board.get_piece(GetMoveSource(move)))]
+                                [GetMoveDestination(move)][get_captured_piece_type(board, move)];
+}
+
+inline Move get_counter_move(const SearchContext &context, const Board &board) {
+  if (board.get_num_made_moves() == 0 || board.get_last_move() == kNullMove) {
+    return kNullMove;
+  }
+  const Square destination = GetMoveDestination(board.get_last_move());
+  return context.counter_moves[board.get_piece(destination)][destination];
+}
+
+inline void UpdateHistory(int32_t &entry, const int32_t bonus) {
+  entry += bonus - entry * std::abs(bonus) / kMaxHistory;
+}
+
+inline void UpdateKillers(SearchContext &context, const int num_made_moves, const Move move) {
+  if (GetMoveType(move) < kCapture) {
+    Array2d<Move, 1024, 2> &killers = context.killers;
+    if (killers[num_made_moves][0] != move) {
+      killers[num_made_moves][1] = killers[num_made_moves][0];
+      killers[num_made_moves][0] = move;
+    }
+  }
+}
+
+//Rewards the move which caused a cutoff and penalizes the moves of the same
+//kind which were searched before it.
+void UpdateHistories(SearchContext &context, const Board &board, const Move best_move,
+                     const Depth depth, const MoveList &quiets, const MoveList &captures) {
+  const int32_t bonus = std::min(32 * depth * depth, kMaxHistory / 4);
+  const Color turn = board.get_turn();
+  if (is_quiet(best_move)) {
+    UpdateHistory(context.history[turn][GetMoveSource(best_move)][GetMoveDestination(best_move)],
+                  bonus);
+    for (Move move : quiets) {
+      UpdateHistory(context.history[turn][GetMoveSource(move)][GetMoveDestination(move)], -bonus);
+    }
+    if (board.get_num_made_moves() > 0 && board.get_last_move() != kNullMove) {
+      const Square destination = GetMoveDestination(board.get_last_move());
+      context.counter_moves[board.get_piece(destination)][destination] = best_move;
+    }
+  }
+  else {
+    UpdateHistory(context.capture_history[GetPieceType(board.get_piece(GetMoveSource(best_move)))]
+        [GetMoveDestination(best_move)][get_captured_piece_type(board, best_move)], bonus);
+  }
+  for (Move move : captures) {
+    UpdateHistory(context.capture_history[GetPieceType(board.get_piece(GetMoveSource(move)))]
+        [GetMoveDestination(move)][get_captured_piece_type(board, move)], -bonus);
+  }
+}
+
 template<int Quiescent>
-int32_t get_move_priority(const Move move, const Board &board, const Move best) {
+int32_t get_move_priority(const SearchContext &context, const Move move,
+                          const Board &board, const Move best) {
   if (move == best)
     return 20000;
   else if (GetMoveType(move) > kCapture) {
     return 11000;
   }
   else if (GetMoveType(move) == kCapture) {
-    return 1000 + 10 * GetPieceType(board.get_piece(GetMoveDestination(move)))
-                - GetPieceType(board.get_piece(GetMoveSource(move)));
+    return 1000 + 100 * GetPieceType(board.get_piece(GetMoveDestination(move)))
+                - 10 * GetPieceType(board.get_piece(GetMoveSource(move)))
+                + get_capture_history(context, board, move) / kCaptureHistoryDivisor;
   }
   else if (Quiescent == kQuiescent) {
     return 10;
   }
-  else if (move == killers[board.get_num_made_moves()][0]) {
+  else if (move == context.killers[board.get_num_made_moves()][0]) {
     return 1001;
   }
-  else if (move == killers[board.get_num_made_moves()][1]) {
+  else if (move == context.killers[board.get_num_made_moves()][1]) {
     return 1000;
   }
   return 10;
 }
 
+//Moves are scored by packing their priority into the upper 16 bits. Instead
+//of sorting the whole list, PickBest selects the best remaining move on
+//demand, which is cheaper since most nodes cut off after a few moves.
 template<int Quiescent>
-void SortMoves(std::vector<Move> &moves, Board &board, const Move best_move) {
+void ScoreMoves(const SearchContext &context, MoveList &moves, Board &board,
+                const Move best_move) {
   for (unsigned int i = 0; i < moves.size(); i++) {
-    moves[i] |= (get_move_priority<Quiescent>(moves[i], board, best_move) << 16);
+    moves[i] |= (get_move_priority<Quiescent>(context, moves[i], board, best_move) << 16);
   }
-  std::sort(moves.begin(), moves.end(), Sorter());
-  for (unsigned int i = 0; i < moves.size(); i++) {
-    moves[i] &= 0xFFFFL;
+}
+
+inline Move PickBest(MoveList &moves, const size_t index) {
+  size_t best = index;
+  for (size_t i = index + 1; i < moves.size(); i++) {
+    if ((moves[i] >> 16) > (moves[best] >> 16)) {
+      best = i;
+    }
   }
+  std::swap(moves[index], moves[best]);
+  moves[index] &= 0xFFFFL;
+  return moves[index];
 }
 
 template<typename T>
@@ -169,7 +404,8 @@ template<> inline void AddFeature<int>(int &s,  const int index) {
 }
 
 template<typename T>
-T GetMoveWeight(const Move move, Board &board, const Move tt_entry,
+T GetMoveWeight(const SearchContext &context, const Move move, Board &board,
+                const Move tt_entry,
                 const Move last_move, const Vec<BitBoard, 6> &direct_checks,
                 const Vec<BitBoard, 6> &taboo_squares) {
   T move_weight = init<T>();
@@ -178,11 +414,11 @@ T GetMoveWeight(const Move move, Board &board, const Move tt_entry,
     return move_weight;
   }
   int num_made_moves = board.get_num_made_moves();
-  if (move == killers[num_made_moves][0]) {
+  if (move == context.killers[num_made_moves][0]) {
     AddFeature<T>(move_weight, kPWIKiller);
     return move_weight;
   }
-  else if (move == killers[num_made_moves][1]) {
+  else if (move == context.killers[num_made_moves][1]) {
     AddFeature<T>(move_weight, kPWIKiller + 1);
     return move_weight;
   }
@@ -216,56 +452,218 @@ T GetMoveWeight(const Move move, Board &board, const Move tt_entry,
   return move_weight;
 }
 
-void SortMovesML(std::vector<Move> &moves, Board &board, const Move best_move) {
+void ScoreMovesML(const SearchContext &context, MoveList &moves, Board &board,
+                  const Move best_move, const Vec<BitBoard, 6> &direct_checks) {
   Move last_move = kNullMove;
   if (board.get_num_made_moves() > 0) {
     last_move = board.get_last_move();
   }
-  const Vec<BitBoard, 6> direct_checks = board.GetDirectCheckingSquares();
   const Vec<BitBoard, 6> taboo_squares = board.GetTabooSquares();
+  const Move counter_move = get_counter_move(context, board);
 
   for (unsigned int i = 0; i < moves.size(); i++) {
-    moves[i] |= ((10000 + GetMoveWeight<int>(moves[i], board, best_move,
-                                             last_move, direct_checks,
-                                             taboo_squares)) << 16);
+    int32_t weight = GetMoveWeight<int>(context, moves[i], board, best_move, last_move,
+                                        direct_checks, taboo_squares);
+    if (is_quiet(moves[i])) {
+      weight += get_history(context, board, moves[i]) / kHistoryDivisor;
+      if (moves[i] == counter_move) {
+        weight += kCounterMoveBonus;
+      }
+    }
+    moves[i] |= ((10000 + weight) << 16);
   }
+}
+
+void SortMovesML(const SearchContext &context, MoveList &moves, Board &board,
+                 const Move best_move) {
+  ScoreMovesML(context, moves, board, best_move, board.GetDirectCheckingSquares());
   std::sort(moves.begin(), moves.end(), Sorter());
   for (unsigned int i = 0; i < moves.size(); i++) {
     moves[i] &= 0xFFFFL;
   }
 }
 
-void build_pv(Board &board, std::vector<Move> &pv, Depth depth) {
-  if (depth == 0) {
-    return;
+//Yields the moves of a node in stages: the hash move, captures which do not
+//lose material, killers, the remaining quiet moves and finally the losing
+//captures. Each stage is only generated and scored once the previous ones
+//failed to produce a cutoff. In check all evasions are generated at once.
+class MovePicker {
+public:
+  MovePicker(const SearchContext &context, Board &board, const Move tt_move,
+             const bool in_check);
+  //Returns kNullMove once all moves have been picked.
+  Move next();
+  const Vec<BitBoard, 6> &get_direct_checks();
+  //YBWC threads sharing a picker order moves with their own tables, as the
+  //owner keeps updating its tables while the split point is active.
+  void set_context(const SearchContext &context);
+
+private:
+  enum Stage {
+    kTTMove, kGenerateCaptures, kGoodCaptures, kKillers, kGenerateQuiets, kQuiets,
+    kBadCaptures, kGenerateEvasions, kEvasions, kDone
+  };
+  bool is_quiet_stage_move(const Move move) const;
+
+  const SearchContext *context;
+  Board &board;
+  const Move tt_move;
+  const bool in_check;
+  int stage;
+  size_t index;
+  MoveList captures;
+  MoveList bad_captures;
+  MoveList moves;
+  Move killers[2];
+  bool direct_checks_computed;
+  Vec<BitBoard, 6> direct_checks;
+};
+
+MovePicker::MovePicker(const SearchContext &context_, Board &board_, const Move tt_move_,
+                       const bool in_check_) : context(&context_), board(board_),
+    tt_move(tt_move_), in_check(in_check_), stage(kTTMove), index(0),
+    direct_checks_computed(false) {
+  killers[0] = kNullMove;
+  killers[1] = kNullMove;
+  if (!board.IsMoveLegal(tt_move)) {
+    stage = in_check ? kGenerateEvasions : kGenerateCaptures;
   }
-  table::Entry entry = table::GetEntry(board.get_hash());
-  bool entry_verified = table::ValidateHash(entry, board.get_hash());
-  table::PVEntry pv_entry = table::GetPVEntry(board.get_hash());
-  bool pv_entry_verified = table::ValidateHash(pv_entry, board.get_hash());
-  if (entry_verified || pv_entry_verified) {
-    std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
-    for (Move move : moves) {
-      if ((move == entry.best_move && entry_verified)
-          || (move == pv_entry.best_move && pv_entry_verified)) {
-        pv.emplace_back(move);
-        board.Make(move);
-        build_pv(board, pv, depth-1);
-        board.UnMake();
-        return;
+}
+
+const Vec<BitBoard, 6> &MovePicker::get_direct_checks() {
+  if (!direct_checks_computed) {
+    direct_checks = board.GetDirectCheckingSquares();
+    direct_checks_computed = true;
+  }
+  return direct_checks;
+}
+
+void MovePicker::set_context(const SearchContext &context_) {
+  context = &context_;
+}
+
+bool MovePicker::is_quiet_stage_move(const Move move) const {
+  if (move == tt_move || move == killers[0] || move == killers[1]) {
+    return false;
+  }
+  //Captures which have not been picked still carry their priority.
+  for (Move capture : captures) {
+    if ((capture & 0xFFFFL) == move) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Move MovePicker::next() {
+  switch (stage) {
+  case kTTMove:
+    stage = in_check ? kGenerateEvasions : kGenerateCaptures;
+    return tt_move;
+  case kGenerateCaptures:
+    captures = board.GetMoves<kQuiescent>();
+    ScoreMoves<kQuiescent>(*context, captures, board, kNullMove);
+    index = 0;
+    stage++;
+    //No break
+  case kGoodCaptures:
+    while (index < captures.size()) {
+      Move move = PickBest(captures, index++);
+      if (move == tt_move) {
+        continue;
+      }
+      if (GetMoveType(move) == kCapture && !board.NonNegativeSEE(move)) {
+        bad_captures.emplace_back(move);
+        continue;
+      }
+      return move;
+    }
+    index = 0;
+    stage++;
+    //No break
+  case kKillers:
+    while (index < 2) {
+      Move killer = context->killers[board.get_num_made_moves()][index++];
+      if (killer != tt_move && killer != killers[0] && GetMoveType(killer) < kEnPassant
+          && board.IsMoveLegal(killer)) {
+        killers[index - 1] = killer;
+        return killer;
+      }
+    }
+    stage++;
+    //No break
+  case kGenerateQuiets: {
+    MoveList all_moves = board.GetMoves<kNonQuiescent>();
+    for (Move move : all_moves) {
+      if (is_quiet_stage_move(move)) {
+        moves.emplace_back(move);
+      }
+    }
+    ScoreMovesML(*context, moves, board, tt_move, get_direct_checks());
+    index = 0;
+    stage++;
+  }
+    //No break
+  case kQuiets:
+    if (index < moves.size()) {
+      return PickBest(moves, index++);
+    }
+    index = 0;
+    stage++;
+    //No break
+  case kBadCaptures:
+    if (index < bad_captures.size()) {
+      return bad_captures[index++];
+    }
+    stage = kDone;
+    return kNullMove;
+  case kGenerateEvasions:
+    moves = board.GetMoves<kNonQuiescent>();
+    ScoreMovesML(*context, moves, board, tt_move, get_direct_checks());
+    index = 0;
+    stage++;
+    //No break
+  case kEvasions:
+    while (index < moves.size()) {
+      Move move = PickBest(moves, index++);
+      if (move != tt_move) {
+        return move;
       }
     }
+    stage = kDone;
+    return kNullMove;
+  }
+  return kNullMove;
+}
+
+inline size_t get_ply(const SearchContext &context, const Board &board) {
+  return board.get_num_made_moves() - context.root_ply;
+}
+
+//Sets the PV of the node at ply to the move followed by the PV of its child.
+inline void update_pv(SearchContext &context, const size_t ply, const Move move) {
+  if (ply >= kMaxPVLength) {
+    return;
+  }
+  context.pv[ply][0] = move;
+  size_t length = 1;
+  if (ply + 1 < kMaxPVLength) {
+    const size_t child_length = std::min(context.pv_length[ply + 1], kMaxPVLength - ply - 1);
+    std::copy(context.pv[ply + 1].begin(), context.pv[ply + 1].begin() + child_length,
+              context.pv[ply].begin() + 1);
+    length += child_length;
   }
+  context.pv_length[ply] = length;
 }
 
 inline bool sufficient_bounds(const Board &board, const table::Entry &entry,
                               const Score alpha, const Score beta,
                               const Depth depth) {
   Score score = entry.get_score(board);
-  return entry.depth >= depth
-      && ((entry.bound == kExactBound)
-          || (entry.bound == kLowerBound && score >= beta)
-          || (entry.bound == kUpperBound && score <= alpha));
+  return entry.get_depth() >= depth
+      && ((entry.get_bound() == kExactBound)
+          || (entry.get_bound() == kLowerBound && score >= beta)
+          || (entry.get_bound() == kUpperBound && score <= alpha));
 }
 
 inline bool is_mate_score(const Score score) {
@@ -279,10 +677,9 @@ inline bool is_null_move_allowed(const Board &board, const Depth depth) {
 
 //This tested negative, may revisit in the future.
 inline bool cutoff_is_prefetchable(Board &board, const Score alpha, const Score beta,
-                                const Depth depth, const std::vector<Move> &moves) {
+                                const Depth depth, const MoveList &moves) {
   for (Move move : moves) {
     board.Make(move);
-    search::dec_node_count();
     if (alpha >= 0 && board.IsDraw()) {
       board.UnMake();
       return true;
@@ -311,7 +708,7 @@ uint64_t Perft(Board &board, Depth depth) {
     return board.GetMoves<kNonQuiescent>().size();
   }
   uint64_t perft_sum = 0;
-  std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
+  MoveList moves = board.GetMoves<kNonQuiescent>();
   for (Move move : moves) {
     board.Make(move);
     perft_sum += Perft(board, depth-1);
@@ -321,60 +718,101 @@ uint64_t Perft(Board &board, Depth depth) {
 }
 
 template<int Mode>
-Score QuiescentSearch(Board &board, Score alpha, Score beta) {
-  max_ply = std::max(board.get_num_made_moves(), max_ply);
+Score QuiescentSearch(SearchContext &context, Board &board, Score alpha, Score beta) {
+  if (board.get_num_made_moves() > context.max_ply.load(std::memory_order_relaxed)) {
+    context.max_ply.store(board.get_num_made_moves(), std::memory_order_relaxed);
+  }
 
   table::Entry entry = table::GetEntry(board.get_hash());
   bool valid_hash = table::ValidateHash(entry,board.get_hash());
   if (valid_hash && sufficient_bounds(board, entry, alpha, beta, 0)) {
     return entry.get_score(board);
   }
+  //Results are stored at depth 0, which must not replace entries of the
+  //same position from the main search.
+  const bool save_entry = !valid_hash || entry.get_depth() == 0;
+  const Score original_alpha = alpha;
   bool in_check = board.InCheck();
   Score static_eval = kMinScore;
+  Score raw_static_eval = kNoStaticEval;
   if (!in_check) {
     if (Mode == kSamplingEvalMode) {
-      evaluation_nodes++;
-      if (evaluation_nodes == kNodeCountSampleEvalAt) {
-        sampled_board.SetToSamePosition(board);
-        end_search_time();
+      context.evaluation_nodes++;
+      if (context.evaluation_nodes == kNodeCountSampleEvalAt) {
+        context.sampled_board.SetToSamePosition(board);
+        end_search_time(context);
       }
     }
 
-    static_eval = evaluation::ScoreBoard(board);
-    if (valid_hash && entry.bound == kLowerBound && static_eval < entry.get_score(board)) {
-      static_eval = entry.get_score(board);
+    if (valid_hash && entry.get_static_eval() != kNoStaticEval) {
+      raw_static_eval = entry.get_static_eval();
+    }
+    else {
+      raw_static_eval = evaluation::ScoreBoard(board);
+    }
+    static_eval = raw_static_eval;
+    //The stored score is a better stand pat estimate if its bound allows it.
+    if (valid_hash) {
+      const Score entry_score = entry.get_score(board);
+      if (entry.get_bound() & (entry_score > static_eval ? kLowerBound : kUpperBound)) {
+        static_eval = entry_score;
+      }
     }
 
     if (static_eval >= beta) {
+      if (save_entry) {
+        table::SaveEntry(board, kNullMove, static_eval, kLowerBound, 0, raw_static_eval);
+      }
       return static_eval;
     }
     if (static_eval > alpha) {
       alpha = static_eval;
     }
   }
-  std::vector<Move> moves = board.GetMoves<kQuiescent>();
+  MoveList moves = board.GetMoves<kQuiescent>();
   if (in_check && moves.size() == 0) {
     return kMinScore+board.get_num_made_moves();
   }
   if (table::ValidateHash(entry,board.get_hash())) {
-    SortMoves<kQuiescent>(moves, board, entry.best_move);
+    ScoreMoves<kQuiescent>(context, moves, board, entry.best_move);
   }
   else {
-    SortMoves<kQuiescent>(moves, board, 0);
+    ScoreMoves<kQuiescent>(context, moves, board, 0);
   }
 
-  for (Move move : moves) {
+  Move best_local_move = kNullMove;
+  for (size_t i = 0; i < moves.size(); i++) {
+    Move move = PickBest(moves, i);
+    if (!in_check && GetMoveType(move) <= kCapture
+        && static_eval + kDeltaPieceValues[get_captured_piece_type(board, move)]
+                       + kDeltaMargin <= alpha) {
+      continue;
+    }
     if (!in_check && GetMoveType(move) != kEnPassant && !board.NonNegativeSEE(move)) {
         continue;
     }
+    table::Prefetch(board.GetHashAfterMove(move));
     board.Make(move);
-    Score score = -QuiescentSearch<Mode>(board, -beta, -alpha);
+    inc_node_count(context);
+    Score score = -QuiescentSearch<Mode>(context, board, -beta, -alpha);
     board.UnMake();
     if (score >= beta) {
+      if (save_entry) {
+        table::SaveEntry(board, move, beta, kLowerBound, 0, raw_static_eval);
+      }
       return beta;
     }
     if (score > alpha) {
       alpha = score;
+      best_local_move = move;
+    }
+  }
+  if (save_entry) {
+    if (alpha > original_alpha) {
+      table::SaveEntry(board, best_local_move, alpha, kExactBound, 0, raw_static_eval);
+    }
+    else {
+      table::SaveEntry(board, kNullMove, alpha, kUpperBound, 0, raw_static_eval);
     }
   }
   return alpha;
@@ -393,57 +831,259 @@ inline Score get_futility_margin(Depth depth, Score score) {
   return kFutileMargin[depth];
 }
 
+//Returns by how many plies a move is reduced, 0 if it is searched at full depth.
+template<int NodeType>
+inline Depth get_reduction(const SearchContext &context, const Board &board, MovePicker &picker,
+                           const Move move, const unsigned int move_number, const Depth depth,
+                           const bool in_check, const bool improving) {
+  Depth reduction = 0;
+  if (!in_check && depth >= 3 && move_number >= (NodeType == kPV ? 4 : 2)
+      && GetMoveType(move) <= kDoublePawnMove
+      && !(picker.get_direct_checks()[GetPieceType(board.get_piece(GetMoveSource(move)))]
+                                    & GetSquareBitBoard(GetMoveDestination(move)))) {
+    reduction = get_lmr_reduction(depth, move_number);
+    if (NodeType == kPV) {
+      reduction--;
+    }
+    if (!improving) {
+      reduction++;
+    }
+    reduction -= get_history(context, board, move) / (kMaxHistory / 2);
+    reduction = std::max(0, std::min(reduction, depth - 2));
+  }
+  assert(reduction < depth);
+  return reduction;
+}
+
+template<int NodeType>
+inline bool is_futile(const Board &board, MovePicker &picker, const Move move, const Depth depth,
+                      const Depth reduction, const Score static_eval, const Score alpha,
+                      const bool in_check) {
+  return NodeType == kNW && settings::kUseScoreBasedPruning
+      && depth - reduction <= 3 && static_eval < (alpha - get_futility_margin(depth - reduction, static_eval))//futility_margin *(depth - reduction))
+      && GetMoveType(move) < kEnPassant && !in_check
+      && !(picker.get_direct_checks()[GetPieceType(board.get_piece(GetMoveSource(move)))]
+                            & GetSquareBitBoard(GetMoveDestination(move)));
+}
+
+template<int NodeType, int Mode>
+Score AlphaBeta(SearchContext &context, Board &board, Score alpha, Score beta,
+                Depth depth);
+
+//Searches a move which has already been made on the board. All moves except
+//the first move of PV nodes are searched with a null window first, possibly
+//reduced, and only re-searched if they turn out better than expected.
+template<int NodeType, int Mode>
+Score SearchLaterMove(SearchContext &context, Board &board, const Score alpha,
+                      const Score beta, const Depth depth, const Depth reduction) {
+  Score score;
+  if (NodeType == kNW) {
+    score = -AlphaBeta<kNW, Mode>(context, board, -beta, -alpha, depth - 1 - reduction);
+    if (reduction > 0 && score >= beta) {
+      score = -AlphaBeta<kNW, Mode>(context, board, -beta, -alpha, depth - 1);
+    }
+  }
+  else {
+    score = -AlphaBeta<kNW, Mode>(context, board, -(alpha+1), -alpha, depth - 1 - reduction);
+    if (reduction > 0 && score >= (alpha+1)) {
+      score = -AlphaBeta<kNW, Mode>(context, board, -(alpha+1), -alpha, depth - 1);
+    }
+    if (score >= (alpha+1)) {
+      score = -AlphaBeta<kPV, Mode>(context, board, -beta, -alpha, depth - 1);
+    }
+  }
+  return score;
+}
+
+//Searches moves of the split point until none are left or a cutoff occurs.
+//Every thread working on the split point runs this on its own board copy.
+template<int NodeType, int Mode>
+void SearchSplitPointMoves(SearchContext &context, Board &board, SplitPoint &split_point) {
+  MovePicker &picker = *split_point.picker;
+  while (true) {
+    std::unique_lock<std::mutex> lock(split_point.mutex);
+    if (finished(context)) {
+      break;
+    }
+    picker.set_context(context);
+    const Move move = picker.next();
+    if (move == kNullMove) {
+      break;
+    }
+    const unsigned int i = split_point.move_number++;
+    const Score alpha = split_point.alpha;
+    lock.unlock();
+
+    const Depth reduction = get_reduction<NodeType>(context, board, picker, move, i,
+        split_point.depth, split_point.in_check, split_point.improving);
+    if (is_futile<NodeType>(board, picker, move, split_point.depth, reduction,
+                            split_point.static_eval, alpha, split_point.in_check)) {
+      continue;
+    }
+    table::Prefetch(board.GetHashAfterMove(move));
+    board.Make(move);
+    inc_node_count(context);
+    const Score score = SearchLaterMove<NodeType, Mode>(context, board, alpha, split_point.beta,
+                                                        split_point.depth, reduction);
+    board.UnMake();
+    if (finished(context)) {
+      break;
+    }
+
+    lock.lock();
+    if (score <= split_point.alpha || split_point.cutoff.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    split_point.best_move = move;
+    if (score >= split_point.beta) {
+      split_point.alpha = split_point.beta;
+      split_point.cutoff.store(true, std::memory_order_relaxed);
+      lock.unlock();
+      UpdateHistories(context, board, move, split_point.depth, MoveList(), MoveList());
+      break;
+    }
+    split_point.alpha = score;
+    if (NodeType == kPV && split_point.ply < kMaxPVLength) {
+      update_pv(context, split_point.ply, move);
+      const size_t length = context.pv_length[split_point.ply];
+      std::copy(context.pv[split_point.ply].begin(),
+                context.pv[split_point.ply].begin() + length, split_point.pv.begin());
+      split_point.pv_length = length;
+    }
+  }
+}
+
+//Hands the remaining moves of a node to idle YBWC workers and searches them
+//together with the workers. Returns false without searching any move if no
+//worker is idle.
+template<int NodeType, int Mode>
+bool Split(SearchContext &context, Board &board, SplitPoint &split_point) {
+  {
+    std::lock_guard<std::mutex> lock(split_mutex);
+    for (size_t i = 0; i < ybwc_workers.size()
+                       && split_point.num_slaves < kMaxSlavesPerSplitPoint; i++) {
+      SearchContext *worker = ybwc_workers[i];
+      if (worker != &context && worker->assigned_split_point == nullptr) {
+        worker->assigned_split_point = &split_point;
+        split_point.num_slaves++;
+        num_idle_workers--;
+      }
+    }
+    if (split_point.num_slaves == 0) {
+      return false;
+    }
+  }
+  split_condition.notify_all();
+  //The picker generates moves from the original board, so it must not change.
+  Board split_board(board);
+  context.split_point = &split_point;
+  SearchSplitPointMoves<NodeType, Mode>(context, split_board, split_point);
+  context.split_point = split_point.parent;
+  std::unique_lock<std::mutex> lock(split_mutex);
+  split_condition.wait(lock, [&split_point] { return split_point.num_slaves == 0; });
+  return true;
+}
+
+//Idle loop of YBWC workers, which search split points they are assigned to
+//until the search ends.
+void WorkerLoop(SearchContext *context) {
+  std::unique_lock<std::mutex> lock(split_mutex);
+  while (true) {
+    split_condition.wait(lock, [context] {
+      return workers_quit || context->assigned_split_point != nullptr;
+    });
+    SplitPoint *split_point = context->assigned_split_point;
+    if (split_point == nullptr) {
+      return;
+    }
+    lock.unlock();
+    Board board(*split_point->board);
+    const size_t num_made_moves = board.get_num_made_moves();
+    context->static_evals[num_made_moves] = split_point->static_evals[1];
+    if (num_made_moves > 0) {
+      context->static_evals[num_made_moves - 1] = split_point->static_evals[0];
+    }
+    context->split_point = split_point;
+    if (split_point->node_type == kPV) {
+      SearchSplitPointMoves<kPV, kNormalSearchMode>(*context, board, *split_point);
+    }
+    else {
+      SearchSplitPointMoves<kNW, kNormalSearchMode>(*context, board, *split_point);
+    }
+    context->split_point = nullptr;
+    lock.lock();
+    context->assigned_split_point = nullptr;
+    split_point->num_slaves--;
+    num_idle_workers++;
+    split_condition.notify_all();
+  }
+}
+
 template<int NodeType, int Mode>
-Score AlphaBeta(Board &board, Score alpha, Score beta, Depth depth) {
+Score AlphaBeta(SearchContext &context, Board &board, Score alpha, Score beta,
+                Depth depth) {
   assert(board.get_num_made_moves() > 0);
   assert(beta > alpha);
   assert(beta == alpha + 1 || NodeType != kNW);
 
+  const size_t ply = get_ply(context, board);
+  if (NodeType == kPV && ply < kMaxPVLength) {
+    context.pv_length[ply] = 0;
+  }
   Score original_alpha = alpha;
   if (board.IsDraw()) {
     return 0;
   }
 
   if (depth <= 0) {
-    return QuiescentSearch<Mode>(board, alpha, beta);
+    return QuiescentSearch<Mode>(context, board, alpha, beta);
   }
 
   table::Entry entry = table::GetEntry(board.get_hash());
   bool valid_entry = table::ValidateHash(entry,board.get_hash());
-  if (valid_entry
+  //PV nodes are always searched, a cutoff would leave the PV truncated here.
+  if (NodeType == kNW && valid_entry
       && sufficient_bounds(board, entry, alpha, beta, depth) ) {
     return entry.get_score(board);
   }
 
   bool in_check = board.InCheck();
+  const int num_made_moves = board.get_num_made_moves();
+  context.static_evals[num_made_moves] = kNoStaticEval;
   Score static_eval = alpha;
+  //Unrefined evaluation of the position, which is saved along with the entry.
+  Score raw_static_eval = kNoStaticEval;
   if (NodeType == kNW && beta > kMinScore + 2000 && alpha < kMaxScore - 2000 && !in_check) {
-    //Score static_eval;
-    if (valid_entry) {
-      if (entry.bound == kExactBound) {
-        static_eval = entry.get_score(board);
+    if (valid_entry && entry.get_bound() == kExactBound) {
+      static_eval = entry.get_score(board);
+    }
+    else {
+      if (valid_entry && entry.get_static_eval() != kNoStaticEval) {
+        raw_static_eval = entry.get_static_eval();
       }
       else {
-        static_eval = evaluation::ScoreBoard(board);
-        if (entry.bound == kLowerBound && static_eval < entry.get_score(board)) {
-          static_eval = entry.get_score(board);
+        raw_static_eval = evaluation::ScoreBoard(board);
+        if (!valid_entry) {
+          table::SaveEntry(board, kNullMove, 0, kNoBound, 0, raw_static_eval);
         }
       }
+      static_eval = raw_static_eval;
+      if (valid_entry && entry.get_bound() == kLowerBound && static_eval < entry.get_score(board)) {
+        static_eval = entry.get_score(board);
+      }
     }
-    else {
-      static_eval = evaluation::ScoreBoard(board);
-    }
+    context.static_evals[num_made_moves] = static_eval;
 
     if (NodeType == kNW && depth <= 3) {
       if (false && Mode == kSamplingSearchMode && static_eval > beta
                 && depth <= kMaxDepthSampled) {
-        sample_nodes++;
-        if (sample_nodes == kNodeCountSampleAt) {
-          sampled_board.SetToSamePosition(board);
-          sampled_depth = depth;
-          sampled_node_type = NodeType;
-          sampled_alpha = alpha;
-          end_search_time();
+        context.sample_nodes++;
+        if (context.sample_nodes == kNodeCountSampleAt) {
+          context.sampled_board.SetToSamePosition(board);
+          context.sampled_depth = depth;
+          context.sampled_node_type = NodeType;
+          context.sampled_alpha = alpha;
+          end_search_time(context);
           return alpha;
         }
       }
@@ -462,8 +1102,10 @@ Score AlphaBeta(Board &board, Score alpha, Score beta, Depth depth) {
       }
     }
     if (static_eval >= beta && is_null_move_allowed(board, depth)) {
+      table::Prefetch(board.GetHashAfterMove(kNullMove));
       board.Make(kNullMove);
-      Score score = -AlphaBeta<kNW, Mode>(board, -beta, -alpha,
+      inc_node_count(context);
+      Score score = -AlphaBeta<kNW, Mode>(context, board, -beta, -alpha,
                                     depth - 1 - settings::R);
       board.UnMake();
       if (score >= beta) {
@@ -471,15 +1113,6 @@ Score AlphaBeta(Board &board, Score alpha, Score beta, Depth depth) {
       }
     }
   }
-  Vec<BitBoard, 6> checking_squares = board.GetDirectCheckingSquares();
-
-  std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
-  if (moves.size() == 0) {
-    if (board.InCheck()) {
-      return kMinScore+board.get_num_made_moves();
-    }
-    return 0;
-  }
 
 //  This tested negative. Perhaps a retry for before NMP and other cutoffs is required
 //  if (false && NodeType == kNW && depth >= 2) {
@@ -489,13 +1122,13 @@ Score AlphaBeta(Board &board, Score alpha, Score beta, Depth depth) {
 //  }
 
   if (Mode == kSamplingSearchMode && NodeType == kNW && depth <= kMaxDepthSampled) {
-    sample_nodes++;
-    if (sample_nodes == kNodeCountSampleAt) {
-      sampled_board.SetToSamePosition(board);
-      sampled_depth = depth;
-      sampled_node_type = NodeType;
-      sampled_alpha = alpha;
-      end_search_time();
+    context.sample_nodes++;
+    if (context.sample_nodes == kNodeCountSampleAt) {
+      context.sampled_board.SetToSamePosition(board);
+      context.sampled_depth = depth;
+      context.sampled_node_type = NodeType;
+      context.sampled_alpha = alpha;
+      end_search_time(context);
       return alpha;
     }
   }
@@ -504,126 +1137,188 @@ Score AlphaBeta(Board &board, Score alpha, Score beta, Depth depth) {
   if (valid_entry) {
     tt_entry = entry.best_move;
   }
-  else {
-    table::PVEntry pv_entry = table::GetPVEntry(board.get_hash());
-    if (table::ValidateHash(pv_entry,board.get_hash())) {
-      tt_entry = pv_entry.best_move;
-    }
-  }
-  bool moves_sorted = false, swapped = false;
-  if (tt_entry != kNullMove) {
-    swapped = SwapToFront(moves, tt_entry);
-    if (swapped && tt_entry != moves[0]) {
-      debug::Error("SwapToFront failed");
-    }
-  }
-  if (!swapped) {
-    SortMovesML(moves, board, tt_entry);
-    moves_sorted = true;
-  }
+  MovePicker picker(context, board, tt_entry, in_check);
 
-  Move best_local_move = moves[0];
-  if (NodeType == kPV && moves.size() == 1) {
+  Move best_local_move = kNullMove;
+  if (NodeType == kPV && board.GetMoves<kNonQuiescent>().size() == 1) {
     depth++;
   }
 
-  for (unsigned int i = 0; i < moves.size(); i++) {
-    if (i == 1 && !moves_sorted) {
-      SortMovesML(moves, board, tt_entry);
-      moves_sorted = true;
-    }
-    Move move = moves[i];
-    Depth reduction = 0;
-    if (NodeType == kNW && !in_check && depth >= 3 && i >= 4
-        && GetMoveType(move) <= kDoublePawnMove
-        && !(checking_squares[GetPieceType(board.get_piece(GetMoveSource(move)))]
-                                      & GetSquareBitBoard(GetMoveDestination(move)))) {
-      reduction = (i >= 8) ? 2 : 1;
-    }
-    assert(reduction < depth);
-    if (NodeType == kNW && settings::kUseScoreBasedPruning
-        && depth - reduction <= 3 && static_eval < (alpha - get_futility_margin(depth - reduction, static_eval))//futility_margin *(depth - reduction))
-        && GetMoveType(move) < kEnPassant && !in_check
-        && !(checking_squares[GetPieceType(board.get_piece(GetMoveSource(move)))]
-                              & GetSquareBitBoard(GetMoveDestination(move)))) {
+  //We are improving if our static eval increased since our last move. Nodes
+  //without a static eval are treated as improving.
+  const bool improving = num_made_moves < 2
+      || context.static_evals[num_made_moves] == kNoStaticEval
+      || context.static_evals[num_made_moves - 2] == kNoStaticEval
+      || context.static_evals[num_made_moves] > context.static_evals[num_made_moves - 2];
+
+  MoveList searched_quiets, searched_captures;
+  const bool mark_searching = context.defer_moves && Mode == kNormalSearchMode && depth >= kMinDeferDepth;
+  //Deferred moves are searched once the picker is exhausted.
+  MoveList deferred_moves;
+  size_t num_deferred_searched = 0;
+  bool deferred_pass = false;
+  auto next_move = [&]() {
+    Move move = deferred_pass ? kNullMove : picker.next();
+    if (move == kNullMove && num_deferred_searched < deferred_moves.size()) {
+      deferred_pass = true;
+      move = deferred_moves[num_deferred_searched++];
+    }
+    return move;
+  };
+  unsigned int i = 0;
+  for (Move move = next_move(); move != kNullMove; move = next_move(), i++) {
+    if (i == 0) {
+      best_local_move = move;
+    }
+    Depth reduction = get_reduction<NodeType>(context, board, picker, move, i, depth,
+                                              in_check, improving);
+    if (is_futile<NodeType>(board, picker, move, depth, reduction, static_eval, alpha,
+                            in_check)) {
       continue;
     }
+    const HashType child_hash = board.GetHashAfterMove(move);
+    if (mark_searching && i > 0 && !deferred_pass
+        && table::IsBeingSearched(child_hash, depth)) {
+      deferred_moves.emplace_back(move);
+      continue;
+    }
+    table::Prefetch(child_hash);
+    if (mark_searching) {
+      table::StartSearching(child_hash, depth);
+    }
     board.Make(move);
+    inc_node_count(context);
     Score score;
-    if (NodeType == kNW) {
-      score = -AlphaBeta<kNW, Mode>(board, -beta, -alpha, depth - 1 - reduction);
-      if (reduction > 0 && score >= beta) {
-        score = -AlphaBeta<kNW, Mode>(board, -beta, -alpha, depth - 1);
-      }
-    }
-    else if (i == 0) {
-      score = -AlphaBeta<kPV, Mode>(board, -beta, -alpha, depth - 1);
+    if (NodeType == kPV && i == 0) {
+      score = -AlphaBeta<kPV, Mode>(context, board, -beta, -alpha, depth - 1);
     }
     else {
-      score = -AlphaBeta<kNW, Mode>(board, -(alpha+1), -alpha, depth - 1);
-      if (score >= (alpha+1)) {
-        score = -AlphaBeta<kPV, Mode>(board, -beta, -alpha, depth - 1);
-      }
+      score = SearchLaterMove<NodeType, Mode>(context, board, alpha, beta, depth, reduction);
     }
     board.UnMake();
-    if (finished()) {
+    if (mark_searching) {
+      table::FinishSearching(child_hash, depth);
+    }
+    if (finished(context)) {
       return alpha;
     }
     if (score >= beta) {
       if (NodeType == kPV) {
         bookkeeping::Inc<0>(i);
       }
-      table::SaveEntry(board, move, score, kLowerBound, depth);
-      if (GetMoveType(move) < kCapture) {
-        int num_made_moves = board.get_num_made_moves();
-        if (killers[num_made_moves][0] != move) {
-          killers[num_made_moves][1] = killers[num_made_moves][0];
-          killers[num_made_moves][0] = move;
-        }
-      }
+      table::SaveEntry(board, move, score, kLowerBound, depth, raw_static_eval);
+      UpdateKillers(context, num_made_moves, move);
+      UpdateHistories(context, board, move, depth, searched_quiets, searched_captures);
       return beta;
     }
+    if (is_quiet(move)) {
+      searched_quiets.emplace_back(move);
+    }
+    else {
+      searched_captures.emplace_back(move);
+    }
     if (score > alpha) {
       if (NodeType == kPV) {
         bookkeeping::Inc<0>(i);
       }
       alpha = score;
       best_local_move = move;
+      if (NodeType == kPV) {
+        update_pv(context, ply, move);
+      }
+    }
+    if (context.smp_mode == search::kYBWC && Mode == kNormalSearchMode && depth >= kMinSplitDepth
+        && num_idle_workers.load(std::memory_order_relaxed) > 0) {
+      //The picker computes direct checks lazily, which has to happen before
+      //other threads share it.
+      picker.get_direct_checks();
+      SplitPoint split_point;
+      split_point.parent = context.split_point;
+      split_point.picker = &picker;
+      split_point.board = &board;
+      split_point.node_type = NodeType;
+      split_point.depth = depth;
+      split_point.beta = beta;
+      split_point.static_eval = static_eval;
+      split_point.static_evals[0] = num_made_moves > 0 ? context.static_evals[num_made_moves - 1]
+                                                       : kNoStaticEval;
+      split_point.static_evals[1] = context.static_evals[num_made_moves];
+      split_point.in_check = in_check;
+      split_point.improving = improving;
+      split_point.ply = ply;
+      split_point.alpha = alpha;
+      split_point.best_move = kNullMove;
+      split_point.move_number = i + 1;
+      split_point.pv_length = 0;
+      split_point.cutoff = false;
+      split_point.num_slaves = 0;
+      if (Split<NodeType, Mode>(context, board, split_point)) {
+        i = split_point.move_number;
+        if (finished(context)) {
+          return alpha;
+        }
+        if (split_point.cutoff) {
+          table::SaveEntry(board, split_point.best_move, beta, kLowerBound, depth,
+                           raw_static_eval);
+          UpdateKillers(context, num_made_moves, split_point.best_move);
+          UpdateHistories(context, board, split_point.best_move, depth, searched_quiets,
+                          searched_captures);
+          return beta;
+        }
+        if (split_point.alpha > alpha) {
+          alpha = split_point.alpha;
+          best_local_move = split_point.best_move;
+          if (NodeType == kPV && ply < kMaxPVLength) {
+            std::copy(split_point.pv.begin(), split_point.pv.begin() + split_point.pv_length,
+                      context.pv[ply].begin());
+            context.pv_length[ply] = split_point.pv_length;
+          }
+        }
+        break;
+      }
     }
   }
+  if (i == 0) {
+    if (in_check) {
+      return kMinScore+board.get_num_made_moves();
+    }
+    return 0;
+  }
   if (alpha > original_alpha) {
     // We should save any best move which has improved alpha.
-    table::SaveEntry(board, best_local_move, alpha, kExactBound, depth);
-    table::SavePVEntry(board, best_local_move);
+    table::SaveEntry(board, best_local_move, alpha, kExactBound, depth, raw_static_eval);
   }
   else if (false) {
     //This tested negative or equal with differing conditions.
     //Intuitively some condition should suffice for this to be an improvement
-    table::SaveEntry(board, moves[0], alpha, kUpperBound, depth);
+    table::SaveEntry(board, best_local_move, alpha, kUpperBound, depth, raw_static_eval);
   }
   return alpha;
 }
 
 template<int Mode>
-Score RootSearchLoop(Board &board, Score alpha, Score beta, Depth current_depth,
-                     std::vector<Move> &moves) {
+Score RootSearchLoop(SearchContext &context, Board &board, Score alpha, Score beta,
+                     Depth current_depth, MoveList &moves) {
   for (int i = 0; i < moves.size(); i++) {
     board.Make(moves[i]);
+    inc_node_count(context);
     if (i == 0) {
-      Score score = -AlphaBeta<kPV, Mode>(board, -beta, -alpha, current_depth - 1);
+      Score score = -AlphaBeta<kPV, Mode>(context, board, -beta, -alpha, current_depth - 1);
       board.UnMake();
       if (score <= alpha || score >= beta) {
         return score;
       }
       alpha = score;
+      update_pv(context, 0, moves[i]);
     }
     else {
-      Score score = -AlphaBeta<kNW, Mode>(board, -(alpha + 1), -alpha, current_depth - 1);
+      Score score = -AlphaBeta<kNW, Mode>(context, board, -(alpha + 1), -alpha,
+                                          current_depth - 1);
       if (score > alpha) {
-        score = -AlphaBeta<kPV, Mode>(board, -beta, -alpha, current_depth - 1);
+        score = -AlphaBeta<kPV, Mode>(context, board, -beta, -alpha, current_depth - 1);
       }
       board.UnMake();
-      if (finished()) {
+      if (finished(context)) {
         return alpha;
       }
       if (score >= beta) {
@@ -633,129 +1328,441 @@ Score RootSearchLoop(Board &board, Score alpha, Score beta, Depth current_depth,
       }
       else if (score > alpha) {
         alpha = score;
+        update_pv(context, 0, moves[i]);
         auto it = moves.rbegin() + moves.size() - i - 1;
         std::rotate(it, it + 1, moves.rend());
       }
     }
   }
   table::SaveEntry(board, moves[0], alpha, kExactBound, current_depth);
-  table::SavePVEntry(board, moves[0]);
   return alpha;
 }
 
+struct RootLine {
+  Move move;
+  Score score;
+  std::vector<Move> pv;
+};
+
+inline RootLine get_root_line(const SearchContext &context, const Move move, const Score score) {
+  RootLine line;
+  line.move = move;
+  line.score = score;
+  line.pv.emplace_back(move);
+  line.pv.insert(line.pv.end(), context.pv[1].begin(),
+                 context.pv[1].begin() + context.pv_length[1]);
+  return line;
+}
+
+//Searches the root such that the first num_lines moves afterwards have exact
+//scores and are sorted, the remaining moves are known to be no better. The
+//first num_lines moves are searched with a full window, all others only have
+//to be compared against the score of the currently worst line.
 template<int Mode>
-Move RootSearch(Board &board, Depth depth){
+std::vector<RootLine> RootSearchLoopMultiPV(SearchContext &context, Board &board,
+                                            Depth current_depth, MoveList &moves,
+                                            const size_t num_lines) {
+  std::vector<RootLine> lines;
+  MoveList other_moves;
+  for (size_t i = 0; i < moves.size(); i++) {
+    board.Make(moves[i]);
+    inc_node_count(context);
+    if (lines.size() < num_lines) {
+      Score score = -AlphaBeta<kPV, Mode>(context, board, kMinScore, kMaxScore,
+                                          current_depth - 1);
+      board.UnMake();
+      if (finished(context)) {
+        return lines;
+      }
+      lines.emplace_back(get_root_line(context, moves[i], score));
+    }
+    else {
+      const Score alpha = lines.back().score;
+      Score score = -AlphaBeta<kNW, Mode>(context, board, -(alpha + 1), -alpha,
+                                          current_depth - 1);
+      if (score > alpha) {
+        score = -AlphaBeta<kPV, Mode>(context, board, kMinScore, -alpha, current_depth - 1);
+      }
+      board.UnMake();
+      if (finished(context)) {
+        return lines;
+      }
+      if (score > alpha) {
+        other_moves.emplace_back(lines.back().move);
+        lines.back() = get_root_line(context, moves[i], score);
+      }
+      else {
+        other_moves.emplace_back(moves[i]);
+      }
+    }
+    std::stable_sort(lines.begin(), lines.end(), [](const RootLine &a, const RootLine &b) {
+      return a.score > b.score;
+    });
+  }
+  for (size_t i = 0; i < lines.size(); i++) {
+    moves[i] = lines[i].move;
+  }
+  for (size_t i = 0; i < other_moves.size(); i++) {
+    moves[lines.size() + i] = other_moves[i];
+  }
+  table::SaveEntry(board, moves[0], lines[0].score, kExactBound, current_depth);
+  return lines;
+}
+
+void PrintSearchInfo(const SearchContext &context, const Board &board, const Depth depth,
+                     const Score score, const Milliseconds time_used,
+                     const std::vector<Move> &pv, const size_t line_number) {
+  size_t max_ply = context.max_ply.load(std::memory_order_relaxed);
+  long nodes = context.nodes.load(std::memory_order_relaxed);
+  for (const SearchContext *helper : context.helpers) {
+    max_ply = std::max(max_ply, helper->max_ply.load(std::memory_order_relaxed));
+    nodes += helper->nodes.load(std::memory_order_relaxed);
+  }
+  std::cout << "info "  << " depth " << depth << " seldepth "
+      << (max_ply - board.get_num_made_moves());
+  if (line_number > 0) {
+    std::cout << " multipv " << line_number;
+  }
+  std::cout << " time " << time_used.count() << " nodes " << nodes;
+  if (!is_mate_score(score)) {
+    std::cout << " score cp "
+        << (score / 8);
+  }
+  else {
+    Score m_score = board.get_num_made_moves();
+    if (score < 0) {
+      m_score = -(score - kMinScore - m_score) / 2;
+      std::cout << " score mate " << m_score;
+    }
+    else {
+      m_score = (kMaxScore - score - m_score + 2) / 2;
+      std::cout << " score mate " << m_score;
+    }
+  }
+  std::cout << " pv";
+  for (Move move : pv) {
+    std::cout << " " << parse::MoveToString(move);
+  }
+  std::cout << std::endl;
+}
+
+template<int Mode>
+Move RootSearch(SearchContext &context, Board &board, Depth depth) {
   // Measure complete search time
   const Time begin = now();
-  max_ply = board.get_num_made_moves();
-  Score score = 0;
-  nodes = 0;
+  const bool main_thread = context.id == 0;
   depth = std::min(depth, settings::kMaxDepth);
-  std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
+  context.nodes = 0;
+  context.max_ply.store(board.get_num_made_moves(), std::memory_order_relaxed);
+  context.root_ply = board.get_num_made_moves();
+  //The root and the ply before it have no static eval of this search, nodes at
+  //ply 1 and 2 must not compare against evals left over from earlier searches.
+  context.static_evals[context.root_ply] = kNoStaticEval;
+  if (context.root_ply > 0) {
+    context.static_evals[context.root_ply - 1] = kNoStaticEval;
+  }
+  context.pv_length[0] = 0;
+  Score score = 0;
+  MoveList moves = board.GetMoves<kNonQuiescent>();
   table::Entry entry = table::GetEntry(board.get_hash());
   Move tt_move = kNullMove;
   if (table::ValidateHash(entry,board.get_hash())) {
     tt_move = entry.best_move;
   }
-  SortMovesML(moves, board, tt_move);
-  for (Depth current_depth = 1; current_depth <= depth; current_depth++) {
-    if(finished()) {
+  SortMovesML(context, moves, board, tt_move);
+  const size_t num_lines = std::min(context.num_pv_lines, moves.size());
+  //Helper threads with odd ids skip the first iteration, so that helpers
+  //spread out over neighbouring depths instead of all searching the same one.
+  const Depth first_depth = context.id > 0 ? 1 + (context.id & 1) : 1;
+  for (Depth current_depth = first_depth; current_depth <= depth; current_depth++) {
+    if(finished(context)) {
       break;
     }
-    if (current_depth == 1) {
-      score = RootSearchLoop<Mode>(board, kMinScore, kMaxScore, current_depth, moves);
+    if (num_lines > 1) {
+      std::vector<RootLine> lines = RootSearchLoopMultiPV<Mode>(context, board, current_depth,
+                                                                moves, num_lines);
+      if (!finished(context)) {
+        score = lines[0].score;
+        context.last_search_score = score;
+        if (print_info) {
+          auto time_used = std::chrono::duration_cast<Milliseconds>(now() - begin);
+          for (size_t i = 0; i < lines.size(); i++) {
+            PrintSearchInfo(context, board, current_depth, lines[i].score, time_used,
+                            lines[i].pv, i + 1);
+          }
+        }
+      }
+      continue;
+    }
+    if (current_depth == first_depth) {
+      score = RootSearchLoop<Mode>(context, board, kMinScore, kMaxScore, current_depth, moves);
     }
     else {
       Score delta = 500;
       Score alpha = std::max(score-delta, kMinScore);
       Score beta = std::min(score+delta, kMaxScore);
-      SortMovesML(moves, board, moves[0]);
-      score = RootSearchLoop<Mode>(board, alpha, beta, current_depth, moves);
-      while (!finished() && (score <= alpha || score >= beta)) {
+      SortMovesML(context, moves, board, moves[0]);
+      score = RootSearchLoop<Mode>(context, board, alpha, beta, current_depth, moves);
+      while (!finished(context) && (score <= alpha || score >= beta)) {
         if (score <= alpha) {
           alpha = std::max(alpha-delta, kMinScore);
         }
         else if (score >= beta) {
           beta = std::min(beta+delta, kMaxScore);
         }
-        score = RootSearchLoop<Mode>(board, alpha, beta, current_depth, moves);
+        score = RootSearchLoop<Mode>(context, board, alpha, beta, current_depth, moves);
         delta *= 2;
       }
     }
-    if(!finished()){
-      last_search_score = score;
-      std::vector<Move> pv;
-      build_pv(board, pv, current_depth);
+    if(!finished(context) && main_thread){
+      context.last_search_score = score;
       Time end = now();
       auto time_used = std::chrono::duration_cast<Milliseconds>(end-begin);
       if (print_info) {
-        std::cout << "info "  << " depth " << current_depth << " seldepth "
-            << (max_ply - board.get_num_made_moves()) << " time "
-            << time_used.count() << " nodes " << nodes;
-        if (!is_mate_score(score)) {
-          std::cout << " score cp "
-              << (score / 8);
-        }
-        else {
-          Score m_score = board.get_num_made_moves();
-          if (score < 0) {
-            m_score = -(score - kMinScore - m_score) / 2;
-            std::cout << " score mate " << m_score;
-          }
-          else {
-            m_score = (kMaxScore - score - m_score + 2) / 2;
-            std::cout << " score mate " << m_score;
-          }
-        }
-        std::cout << " pv";
-        for (Move move : pv) {
-          std::cout << " " << parse::MoveToString(move);
-        }
-        std::cout << std::endl;
+        std::vector<Move> pv(context.pv[0].begin(), context.pv[0].begin() + context.pv_length[0]);
+        PrintSearchInfo(context, board, current_depth, score, time_used, pv, 0);
       }
     }
   }
   return moves[0];
 }
 
+//Runs the part of every engine search which belongs to a helper context until
+//the helper threads are stopped. Searches with an id after the given one are
+//run, so one started before the thread gets to run is not missed.
+void HelperLoop(SearchContext *context, size_t search_id) {
+  std::unique_lock<std::mutex> lock(pool_mutex);
+  while (true) {
+    pool_condition.wait(lock, [&search_id] {
+      return pool_quit || pool_search_id != search_id;
+    });
+    if (pool_quit) {
+      return;
+    }
+    search_id = pool_search_id;
+    Board board;
+    board.SetToSamePosition(pool_board);
+    const Depth depth = pool_depth;
+    lock.unlock();
+    if (context->smp_mode == kYBWC) {
+      WorkerLoop(context);
+    }
+    else {
+      RootSearch<kNormalSearchMode>(*context, board, depth);
+    }
+    lock.lock();
+    num_busy_helpers--;
+    pool_condition.notify_all();
+  }
+}
+
+//Runs a search on the engine's own contexts, which ends at the end time of the
+//main context or once it is stopped. Lazy SMP: helper threads run the
+//same iterative deepening on their own copy of the board and only communicate
+//through the transposition table. YBWC: helper threads wait in WorkerLoop
+//until the main search splits a node. Either way the helper threads are woken
+//up from HelperLoop and the search returns once all of them are done.
+Move EngineSearch(Board &board, Depth depth) {
+  table::IncrementGeneration();
+  SearchContext &main_context = *contexts[0];
+  const Time end_time = main_context.end_time.load(std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(helpers_mutex);
+    main_context.helpers.clear();
+    for (size_t i = 1; i < contexts.size(); i++) {
+      main_context.helpers.emplace_back(contexts[i].get());
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(split_mutex);
+    workers_quit = false;
+    ybwc_workers.clear();
+  }
+  //Only the main thread reports several lines, helpers just fill the table.
+  main_context.num_pv_lines = num_pv_lines;
+  for (std::unique_ptr<SearchContext> &context : contexts) {
+    context->smp_mode = smp_mode;
+    context->defer_moves = smp_mode == kLazySMP && contexts.size() > 1;
+  }
+  for (size_t i = 1; i < contexts.size(); i++) {
+    SearchContext *helper = contexts[i].get();
+    helper->nodes = 0;
+    helper->max_ply.store(0, std::memory_order_relaxed);
+    if (smp_mode == kYBWC) {
+      helper->set_end_time(end_time);
+      helper->root_ply = board.get_num_made_moves();
+      num_idle_workers++;
+      std::lock_guard<std::mutex> lock(split_mutex);
+      ybwc_workers.emplace_back(helper);
+    }
+    else {
+      helper->set_end_time(get_infinite_time());
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    pool_board.SetToSamePosition(board);
+    pool_depth = depth;
+    num_busy_helpers = contexts.size() - 1;
+    pool_search_id++;
+  }
+  pool_condition.notify_all();
+  Move best_move = RootSearch<kNormalSearchMode>(main_context, board, depth);
+  main_context.end_search();
+  {
+    std::lock_guard<std::mutex> lock(split_mutex);
+    workers_quit = true;
+    ybwc_workers.clear();
+  }
+  split_condition.notify_all();
+  {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    pool_condition.wait(lock, [] { return num_busy_helpers == 0; });
+  }
+  num_idle_workers = 0;
+  return best_move;
+}
+
+SearchContext::SearchContext(const int id_) : id(id_), smp_mode(search::kLazySMP),
+    defer_moves(false), num_pv_lines(1), root_ply(0), max_ply(0), nodes(0),
+    end_time(now()), stopped(false), last_search_score(0), sample_nodes(0), evaluation_nodes(0),
+    sampled_alpha(kMinScore), sampled_node_type(kPV), sampled_depth(0) {
+  pv_length.fill(0);
+  split_point = nullptr;
+  assigned_split_point = nullptr;
+  clear_killers();
+  clear_history();
+  static_evals.fill(kNoStaticEval);
+}
+
+void SearchContext::clear_killers() {
+  for (size_t i = 0; i < killers.size(); i++) {
+    killers[i][0] = 0;
+    killers[i][1] = 0;
+  }
+}
+
+void SearchContext::clear_history() {
+  for (Array2d<int32_t, 64, 64> &color_history : history) {
+    for (std::array<int32_t, 64> &source_history : color_history) {
+      source_history.fill(0);
+    }
+  }
+  for (Array2d<int32_t, 64, kNumPieceTypes> &piece_history : capture_history) {
+    for (std::array<int32_t, kNumPieceTypes> &destination_history : piece_history) {
+      destination_history.fill(0);
+    }
+  }
+  for (std::array<Move, 64> &piece_counter_moves : counter_moves) {
+    piece_counter_moves.fill(kNullMove);
+  }
+}
+
+void SearchContext::set_end_time(const Time time) {
+  end_time.store(time, std::memory_order_relaxed);
+  stopped.store(false, std::memory_order_relaxed);
+}
+
+void SearchContext::end_search() {
+  end_search_time(*this);
+  for (SearchContext *helper : helpers) {
+    end_search_time(*helper);
+  }
+}
+
 void set_print_info(bool print_info_) {
   print_info = print_info_;
 }
 
+void set_smp_mode(const int mode) {
+  smp_mode = mode;
+}
+
+void set_num_pv_lines(const size_t num_lines) {
+  num_pv_lines = std::max(num_lines, (size_t) 1);
+}
+
+void set_num_threads(const size_t num_threads) {
+  helper_threads.Stop();
+  {
+    std::lock_guard<std::mutex> lock(helpers_mutex);
+    contexts[0]->helpers.clear();
+  }
+  size_t search_id;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    search_id = pool_search_id;
+  }
+  contexts.resize(std::max(num_threads, (size_t) 1));
+  for (size_t i = 1; i < contexts.size(); i++) {
+    if (!contexts[i]) {
+      contexts[i].reset(new SearchContext(i));
+    }
+    helper_threads.threads.emplace_back(HelperLoop, contexts[i].get(), search_id);
+  }
+}
+
 Score get_last_search_score() {
-  return last_search_score;
+  return contexts[0]->last_search_score;
+}
+
+long get_last_search_nodes() {
+  long nodes = 0;
+  for (const std::unique_ptr<SearchContext> &context : contexts) {
+    nodes += context->nodes.load(std::memory_order_relaxed);
+  }
+  return nodes;
 }
 
 Move DepthSearch(Board board, Depth depth) {
-  end_time = get_infinite_time();
-  return RootSearch<kNormalSearchMode>(board, depth);
+  set_end_time(get_infinite_time());
+  return EngineSearch(board, depth);
 }
 
 Move TimeSearch(Board board, Milliseconds duration) {
-  end_time = now()+duration;
-  return RootSearch<kNormalSearchMode>(board, 1000);
+  set_end_time(now()+duration);
+  return EngineSearch(board, 1000);
 }
 
-void inc_node_count() {
-  nodes++;
+void set_end_time(const Time end_time) {
+  contexts[0]->set_end_time(end_time);
 }
 
-void dec_node_count() {
-  nodes--;
+Move Search(Board board, Depth depth) {
+  return EngineSearch(board, depth);
+}
+
+Move DepthSearch(SearchContext &context, Board board, Depth depth) {
+  table::IncrementGeneration();
+  context.set_end_time(get_infinite_time());
+  return RootSearch<kNormalSearchMode>(context, board, depth);
+}
+
+Move TimeSearch(SearchContext &context, Board board, Milliseconds duration) {
+  table::IncrementGeneration();
+  context.set_end_time(now()+duration);
+  return RootSearch<kNormalSearchMode>(context, board, 1000);
 }
 
 void end_search() {
-  end_time = now();
+  std::lock_guard<std::mutex> lock(helpers_mutex);
+  contexts[0]->end_search();
 }
 
 void clear_killers() {
-  for (size_t i = 0; i < killers.size(); i++) {
-    killers[i][0] = 0;
-    killers[i][1] = 0;
+  for (size_t i = 0; i < contexts.size(); i++) {
+    contexts[i]->clear_killers();
+  }
+}
+
+void clear_history() {
+  for (size_t i = 0; i < contexts.size(); i++) {
+    contexts[i]->clear_history();
   }
 }
 
 void TrainSearchParamsOrderBased(bool from_scratch) {
+  SearchContext context;
   const int scaling = 128;
   set_print_info(false);
   std::vector<double> weights(kNumMoveProbabilityFeatures);
@@ -771,46 +1778,46 @@ void TrainSearchParamsOrderBased(bool from_scratch) {
   int sampled_positions = 0;
   std::vector<double> sampled_depths(kMaxDepthSampled, 0);
   while (true) {
-    clear_killers();
+    context.clear_killers();
     table::ClearTable();
     kNodeCountSampleAt = 300 + rng() % 200;
     Game game = games[rng() % games.size()];
-    end_time = now() + Milliseconds(100);
+    context.set_end_time(now() + Milliseconds(100));
     Board board = game.board;
-    sample_nodes = 0;
-    sampled_alpha = kMinScore;
-    RootSearch<kSamplingSearchMode>(board, 128);
-    if (sampled_alpha == kMinScore) {
+    context.sample_nodes = 0;
+    context.sampled_alpha = kMinScore;
+    RootSearch<kSamplingSearchMode>(context, board, 128);
+    if (context.sampled_alpha == kMinScore) {
       continue;
     }
-    end_time = get_infinite_time();
+    context.set_end_time(get_infinite_time());
     Move last_move = kNullMove;
-    if (sampled_board.get_num_made_moves() > 0) {
-      last_move = sampled_board.get_last_move();
+    if (context.sampled_board.get_num_made_moves() > 0) {
+      last_move = context.sampled_board.get_last_move();
     }
-    std::vector<Move> moves = sampled_board.GetMoves<kNonQuiescent>();
+    MoveList moves = context.sampled_board.GetMoves<kNonQuiescent>();
     std::shuffle(moves.begin(), moves.end(), rng);
-    SortMovesML(moves, sampled_board, kNullMove);
+    SortMovesML(context, moves, context.sampled_board, kNullMove);
     std::vector<std::vector<int> > features;
-    Vec<BitBoard, 6> direct_checks = sampled_board.GetDirectCheckingSquares();
-    Vec<BitBoard, 6> taboo_squares = sampled_board.GetTabooSquares();
+    Vec<BitBoard, 6> direct_checks = context.sampled_board.GetDirectCheckingSquares();
+    Vec<BitBoard, 6> taboo_squares = context.sampled_board.GetTabooSquares();
     for (int i = 0; i < moves.size(); i++) {
-      features.emplace_back(GetMoveWeight<std::vector<int> >(moves[i], sampled_board,
+      features.emplace_back(GetMoveWeight<std::vector<int> >(context, moves[i], context.sampled_board,
                                                             kNullMove, last_move,
                                                             direct_checks, taboo_squares));
     }
-    Score alpha = sampled_alpha - 1;
+    Score alpha = context.sampled_alpha - 1;
     Score beta = kMaxScore;
     sampled_positions++;
-    sampled_depths[sampled_depth - 1]++;
+    sampled_depths[context.sampled_depth - 1]++;
     for (int i = 0; i < moves.size(); i++) {
       Score score;
-      sampled_board.Make(moves[i]);
-      score = -AlphaBeta<kPV, kNormalSearchMode>(sampled_board,
+      context.sampled_board.Make(moves[i]);
+      score = -AlphaBeta<kPV, kNormalSearchMode>(context, context.sampled_board,
                                                  -beta,
                                                  -alpha,
-                                                 sampled_depth - 1);
-      sampled_board.UnMake();
+                                                 context.sampled_depth - 1);
+      context.sampled_board.UnMake();
       double target = 0;
       if (score > alpha) {
         if (score == alpha + 1) {
@@ -857,6 +1864,7 @@ void TrainSearchParamsOrderBased(bool from_scratch) {
 }
 
 void CreateSearchParamDataset(bool from_scratch) {
+  SearchContext context;
   if (from_scratch) {
     debug::Error("Dataset creation from scratch not supported at the moment.");
   }
@@ -866,7 +1874,7 @@ void CreateSearchParamDataset(bool from_scratch) {
   int sampled_positions = 0;
   int all_above = 0, all_below = 0, too_easy = 0;
   while (samples.size() < 1 * kMillion) {
-    clear_killers();
+    context.clear_killers();
     table::ClearTable();
     kNodeCountSampleAt = 1000 + rng() % 500;
     Game game = games[rng() % games.size()];
@@ -875,41 +1883,41 @@ void CreateSearchParamDataset(bool from_scratch) {
     }
     game.set_to_position_after((1 * game.moves.size() / 3)
                                + (rng() % (2 * game.moves.size() / 3)) - 2);
-    end_time = now() + Milliseconds(200);
+    context.set_end_time(now() + Milliseconds(200));
     Board board = game.board;
-    sample_nodes = 0;
-    sampled_alpha = kMinScore;
-    RootSearch<kSamplingSearchMode>(board, 128);
-    if (sampled_alpha == kMinScore) {
+    context.sample_nodes = 0;
+    context.sampled_alpha = kMinScore;
+    RootSearch<kSamplingSearchMode>(context, board, 128);
+    if (context.sampled_alpha == kMinScore) {
       continue;
     }
-    end_time = get_infinite_time();
+    context.set_end_time(get_infinite_time());
     Move last_move = kNullMove;
-    if (sampled_board.get_num_made_moves() > 0) {
-      last_move = sampled_board.get_last_move();
+    if (context.sampled_board.get_num_made_moves() > 0) {
+      last_move = context.sampled_board.get_last_move();
     }
-    std::vector<Move> moves = sampled_board.GetMoves<kNonQuiescent>();
+    MoveList moves = context.sampled_board.GetMoves<kNonQuiescent>();
     std::shuffle(moves.begin(), moves.end(), rng);
-    SortMovesML(moves, sampled_board, kNullMove);
+    SortMovesML(context, moves, context.sampled_board, kNullMove);
     std::vector<std::vector<int> > features;
-    Vec<BitBoard, 6> direct_checks = sampled_board.GetDirectCheckingSquares();
-    Vec<BitBoard, 6> taboo_squares = sampled_board.GetTabooSquares();
+    Vec<BitBoard, 6> direct_checks = context.sampled_board.GetDirectCheckingSquares();
+    Vec<BitBoard, 6> taboo_squares = context.sampled_board.GetTabooSquares();
     for (int i = 0; i < moves.size(); i++) {
-      features.emplace_back(GetMoveWeight<std::vector<int> >(moves[i], sampled_board,
+      features.emplace_back(GetMoveWeight<std::vector<int> >(context, moves[i], context.sampled_board,
                                                              kNullMove,last_move,
                                                              direct_checks, taboo_squares));
     }
     std::vector<Score> scores(features.size());
     int low = 0, high = 0;
     for (int i = 0; i < moves.size(); i++) {
-      sampled_board.Make(moves[i]);
-      Score score = -AlphaBeta<kNW, kNormalSearchMode>(sampled_board,
-                                                       -(sampled_alpha+1),
-                                                       -sampled_alpha,
-                                                       sampled_depth - 1);
-      sampled_board.UnMake();
+      context.sampled_board.Make(moves[i]);
+      Score score = -AlphaBeta<kNW, kNormalSearchMode>(context, context.sampled_board,
+                                                       -(context.sampled_alpha+1),
+                                                       -context.sampled_alpha,
+                                                       context.sampled_depth - 1);
+      context.sampled_board.UnMake();
       scores[i] = score;
-      if (score > sampled_alpha) {
+      if (score > context.sampled_alpha) {
         high++;
         if (high > moves.size() / 2) {
           break;
@@ -933,19 +1941,19 @@ void CreateSearchParamDataset(bool from_scratch) {
     }
     int i = rng() % moves.size();
     Score score;
-    sampled_board.Make(moves[i]);
-    if (sampled_node_type == kNW) {
+    context.sampled_board.Make(moves[i]);
+    if (context.sampled_node_type == kNW) {
       score = scores[i];
     }
     else {
-      score = -AlphaBeta<kPV, kNormalSearchMode>(sampled_board,
-                                                 -(sampled_alpha+1),
-                                                 -sampled_alpha,
-                                                 sampled_depth - 1);
+      score = -AlphaBeta<kPV, kNormalSearchMode>(context, context.sampled_board,
+                                                 -(context.sampled_alpha+1),
+                                                 -context.sampled_alpha,
+                                                 context.sampled_depth - 1);
     }
-    sampled_board.UnMake();
+    context.sampled_board.UnMake();
     int target = 0;
-    if (score > sampled_alpha) {
+    if (score > context.sampled_alpha) {
       target = 1;
     }
     features[i][0] = target;
@@ -964,6 +1972,7 @@ void CreateSearchParamDataset(bool from_scratch) {
 }
 
 void TrainSearchParams(bool from_scratch) {
+  SearchContext context;
   const int scaling = 128;
   set_print_info(false);
   std::vector<double> weights(kNumMoveProbabilityFeatures);
@@ -984,7 +1993,7 @@ void TrainSearchParams(bool from_scratch) {
   int sampled_positions = 0;
   int all_above = 0, all_below = 0, too_easy = 0;
   while (true) {
-    clear_killers();
+    context.clear_killers();
     table::ClearTable();
     kNodeCountSampleAt = 800 + rng() % 400;
     Game game = games[rng() % games.size()];
@@ -993,41 +2002,41 @@ void TrainSearchParams(bool from_scratch) {
     }
     game.set_to_position_after((2 * game.moves.size() / 3)
                                + (rng() % (game.moves.size() / 3)) - 2);
-    end_time = now() + Milliseconds(150);
+    context.set_end_time(now() + Milliseconds(150));
     Board board = game.board;
-    sample_nodes = 0;
-    sampled_alpha = kMinScore;
-    RootSearch<kSamplingSearchMode>(board, 128);
-    if (sampled_alpha == kMinScore) {
+    context.sample_nodes = 0;
+    context.sampled_alpha = kMinScore;
+    RootSearch<kSamplingSearchMode>(context, board, 128);
+    if (context.sampled_alpha == kMinScore) {
       continue;
     }
-    end_time = get_infinite_time();
+    context.set_end_time(get_infinite_time());
     Move last_move = kNullMove;
-    if (sampled_board.get_num_made_moves() > 0) {
-      last_move = sampled_board.get_last_move();
+    if (context.sampled_board.get_num_made_moves() > 0) {
+      last_move = context.sampled_board.get_last_move();
     }
-    std::vector<Move> moves = sampled_board.GetMoves<kNonQuiescent>();
+    MoveList moves = context.sampled_board.GetMoves<kNonQuiescent>();
     std::shuffle(moves.begin(), moves.end(), rng);
-    SortMovesML(moves, sampled_board, kNullMove);
+    SortMovesML(context, moves, context.sampled_board, kNullMove);
     std::vector<std::vector<int> > features;
-    Vec<BitBoard, 6> direct_checks = sampled_board.GetDirectCheckingSquares();
-    Vec<BitBoard, 6> taboo_squares = sampled_board.GetTabooSquares();
+    Vec<BitBoard, 6> direct_checks = context.sampled_board.GetDirectCheckingSquares();
+    Vec<BitBoard, 6> taboo_squares = context.sampled_board.GetTabooSquares();
     for (int i = 0; i < moves.size(); i++) {
-      features.emplace_back(GetMoveWeight<std::vector<int> >(moves[i], sampled_board,
+      features.emplace_back(GetMoveWeight<std::vector<int> >(context, moves[i], context.sampled_board,
                                                              kNullMove,last_move,
                                                              direct_checks, taboo_squares));
     }
     std::vector<Score> scores(features.size());
     int low = 0, high = 0;
     for (int i = 0; i < moves.size(); i++) {
-      sampled_board.Make(moves[i]);
-      Score score = -AlphaBeta<kNW, kNormalSearchMode>(sampled_board,
-                                                       -(sampled_alpha+1),
-                                                       -sampled_alpha,
-                                                       sampled_depth - 1);
-      sampled_board.UnMake();
+      context.sampled_board.Make(moves[i]);
+      Score score = -AlphaBeta<kNW, kNormalSearchMode>(context, context.sampled_board,
+                                                       -(context.sampled_alpha+1),
+                                                       -context.sampled_alpha,
+                                                       context.sampled_depth - 1);
+      context.sampled_board.UnMake();
       scores[i] = score;
-      if (score > sampled_alpha) {
+      if (score > context.sampled_alpha) {
         high++;
         if (high > moves.size() / 2) {
           break;
@@ -1055,19 +2064,19 @@ void TrainSearchParams(bool from_scratch) {
         continue;
       }
       Score score;
-      sampled_board.Make(moves[i]);
-      if (sampled_node_type == kNW) {
+      context.sampled_board.Make(moves[i]);
+      if (context.sampled_node_type == kNW) {
         score = scores[i];
       }
       else {
-        score = -AlphaBeta<kPV, kNormalSearchMode>(sampled_board,
-                                                  -(sampled_alpha+1),
-                                                  -sampled_alpha,
-                                                  sampled_depth - 1);
+        score = -AlphaBeta<kPV, kNormalSearchMode>(context, context.sampled_board,
+                                                  -(context.sampled_alpha+1),
+                                                  -context.sampled_alpha,
+                                                  context.sampled_depth - 1);
       }
-      sampled_board.UnMake();
+      context.sampled_board.UnMake();
       double target = 0;
-      if (score > sampled_alpha) {
+      if (score > context.sampled_alpha) {
         target = 1;
       }
       double final_score = 0;
@@ -1107,6 +2116,7 @@ void TrainSearchParams(bool from_scratch) {
 }
 
 void TrainSearchParamsPairwise(bool from_scratch) {
+  SearchContext context;
   set_print_info(false);
   std::vector<double> weights(kNumMoveProbabilityFeatures);
   if (!from_scratch) {
@@ -1121,64 +2131,58 @@ void TrainSearchParamsPairwise(bool from_scratch) {
   int sampled_positions = 0;
   std::vector<double> sampled_depths(kMaxDepthSampled, 0);
   while (true) {
-    clear_killers();
+    context.clear_killers();
     table::ClearTable();
     kNodeCountSampleAt = 300 + rng() % 200;
     Game game = games[rng() % games.size()];
-    end_time = now() + Milliseconds(100);
+    context.set_end_time(now() + Milliseconds(100));
     Board board = game.board;
-    sample_nodes = 0;
-    sampled_alpha = kMinScore;
-    RootSearch<kSamplingSearchMode>(board, 128);
-    if (sampled_alpha == kMinScore) {
+    context.sample_nodes = 0;
+    context.sampled_alpha = kMinScore;
+    RootSearch<kSamplingSearchMode>(context, board, 128);
+    if (context.sampled_alpha == kMinScore) {
       continue;
     }
-    end_time = get_infinite_time();
+    context.set_end_time(get_infinite_time());
     Move tt_move = 0;
-    table::Entry entry = table::GetEntry(sampled_board.get_hash());
-    if (table::ValidateHash(entry, sampled_board.get_hash())) {
+    table::Entry entry = table::GetEntry(context.sampled_board.get_hash());
+    if (table::ValidateHash(entry, context.sampled_board.get_hash())) {
       tt_move = entry.best_move;
     }
-    else {
-      table::PVEntry pv_entry = table::GetPVEntry(sampled_board.get_hash());
-      if (table::ValidateHash(pv_entry, sampled_board.get_hash())) {
-        tt_move = pv_entry.best_move;
-      }
-    }
     Move last_move = kNullMove;
-    if (sampled_board.get_num_made_moves() > 0) {
-      last_move = sampled_board.get_last_move();
+    if (context.sampled_board.get_num_made_moves() > 0) {
+      last_move = context.sampled_board.get_last_move();
     }
-    std::vector<Move> moves = sampled_board.GetMoves<kNonQuiescent>();
+    MoveList moves = context.sampled_board.GetMoves<kNonQuiescent>();
     if (moves.size() <= 1) {
       continue;
     }
     std::shuffle(moves.begin(), moves.end(), rng);
-    SortMovesML(moves, board, tt_move);
-    Vec<BitBoard, 6> direct_checks = sampled_board.GetDirectCheckingSquares();
-    Vec<BitBoard, 6> taboo_squares = sampled_board.GetTabooSquares();
+    SortMovesML(context, moves, board, tt_move);
+    Vec<BitBoard, 6> direct_checks = context.sampled_board.GetDirectCheckingSquares();
+    Vec<BitBoard, 6> taboo_squares = context.sampled_board.GetTabooSquares();
     std::vector<std::vector<int> > features;
     for (int i = 0; i < moves.size(); i++) {
-      features.emplace_back(GetMoveWeight<std::vector<int> >(moves[i], sampled_board,
+      features.emplace_back(GetMoveWeight<std::vector<int> >(context, moves[i], context.sampled_board,
                                                                    tt_move,last_move,
                                                                    direct_checks, taboo_squares));
     }
     std::vector<Score> scores(features.size());
     int above_alpha = 0;
     for (int i = 0; i < moves.size(); i++) {
-      sampled_board.Make(moves[i]);
-      scores[i] = -AlphaBeta<kPV, kNormalSearchMode>(sampled_board,
+      context.sampled_board.Make(moves[i]);
+      scores[i] = -AlphaBeta<kPV, kNormalSearchMode>(context, context.sampled_board,
                                                  kMinScore,
                                                  kMaxScore,
-                                                 sampled_depth - 1);
-      sampled_board.UnMake();
-      if (scores[i] > sampled_alpha)
+                                                 context.sampled_depth - 1);
+      context.sampled_board.UnMake();
+      if (scores[i] > context.sampled_alpha)
         above_alpha++;
     }
     sampled_positions++;
-    sampled_depths[sampled_depth - 1]++;
+    sampled_depths[context.sampled_depth - 1]++;
     std::vector<double> gradients(weights.size(), 0);
-    double sample_importance = sampled_positions / sampled_depths[sampled_depth-1];
+    double sample_importance = sampled_positions / sampled_depths[context.sampled_depth-1];
     for (int i = 0; i < moves.size() - 1; i++) {
       int j = i + 1;
       if (scores[i] == scores[j]) {
@@ -1214,15 +2218,20 @@ void TrainSearchParamsPairwise(bool from_scratch) {
 }
 
 
+Score QSearch(SearchContext &context, Board &board) {
+  return QuiescentSearch<kNormalSearchMode>(context, board, kMinScore, kMaxScore);
+}
+
 Score QSearch(Board &board) {
-  return QuiescentSearch<kNormalSearchMode>(board, kMinScore, kMaxScore);
+  return QSearch(*contexts[0], board);
 }
 
 Board SampleEval(Board board) {
-  end_time = now() + Milliseconds(1000000);
-  evaluation_nodes = 0;
-  RootSearch<kSamplingEvalMode>(board, 128);
-  return sampled_board;
+  SearchContext context;
+  context.set_end_time(now() + Milliseconds(1000000));
+  context.evaluation_nodes = 0;
+  RootSearch<kSamplingEvalMode>(context, board, 128);
+  return context.sampled_board;
 }
 
 void SaveSearchVariables() {
@@ -1252,6 +2261,7 @@ void LoadSearchVariables() {
 }
 
 void EvaluateScoreDistributions(const int focus) {
+  SearchContext context;
   set_print_info(false);
   long count1 = 0, count2 = 0;
   std::vector<Game> games = data::LoadGames(1200000);
@@ -1271,20 +2281,20 @@ void EvaluateScoreDistributions(const int focus) {
     Game game = games[rng() % games.size()];
     int index = (rng() % (2 * game.moves.size() / 3)) + (game.moves.size() / 3) - 2;
     game.set_to_position_after(index);
-    clear_killers();
+    context.clear_killers();
     table::ClearTable();
 
     kNodeCountSampleAt = 300 + rng() % 150;
-    end_time = now() + Milliseconds(150);
+    context.set_end_time(now() + Milliseconds(150));
     Board board = game.board;
-    sample_nodes = 0;
-    sampled_alpha = kMinScore;
-    RootSearch<kSamplingSearchMode>(board, 128);
-    if (sampled_alpha == kMinScore || sampled_board.InCheck()) {
+    context.sample_nodes = 0;
+    context.sampled_alpha = kMinScore;
+    RootSearch<kSamplingSearchMode>(context, board, 128);
+    if (context.sampled_alpha == kMinScore || context.sampled_board.InCheck()) {
       continue;
     }
-    end_time = get_infinite_time();
-    Score score = evaluation::ScoreBoard(sampled_board);
+    context.set_end_time(get_infinite_time());
+    Score score = evaluation::ScoreBoard(context.sampled_board);
     Score score_bin_idx = score;
     score_bin_idx += score_bin_size / 2;
     score_bin_idx /= score_bin_size;
@@ -1293,7 +2303,7 @@ void EvaluateScoreDistributions(const int focus) {
     score_bin_idx = std::min(n_score_bins - 1, (int)score_bin_idx);
     if (focus == 0) {
       for (int depth = 1; depth <= max_depth; depth++) {
-        DepthSearch(sampled_board, depth);
+        DepthSearch(context.sampled_board, depth);
         Score ab_score = get_last_search_score();
         Score dif = ab_score - score;
         dif /= dif_bin_size;
@@ -1304,26 +2314,26 @@ void EvaluateScoreDistributions(const int focus) {
       }
     }
     else if (focus == 1) {
-      std::vector<Move> moves = sampled_board.GetMoves<kNonQuiescent>();
+      MoveList moves = context.sampled_board.GetMoves<kNonQuiescent>();
       for (int depth = 1; depth <= max_depth; depth++) {
         for (Move move : moves) {
           if (GetMoveType(move) >= kEnPassant) {
             continue;
           }
-          sampled_board.Make(move);
-          if (sampled_board.InCheck()) {
-            sampled_board.UnMake();
+          context.sampled_board.Make(move);
+          if (context.sampled_board.InCheck()) {
+            context.sampled_board.UnMake();
             continue;
           }
           Score ab_score = 0;
           if (depth == 1) {
-            ab_score = -QSearch(sampled_board);
+            ab_score = -QSearch(context.sampled_board);
           }
           else {
-            DepthSearch(sampled_board, depth - 1);
+            DepthSearch(context.sampled_board, depth - 1);
             ab_score = -get_last_search_score();
           }
-          sampled_board.UnMake();
+          context.sampled_board.UnMake();
 
           Score dif = ab_score - score;
           dif /= dif_bin_size;
@@ -1335,7 +2345,7 @@ void EvaluateScoreDistributions(const int focus) {
       }
     }
     else if (focus == 2) {
-      std::vector<Move> moves = sampled_board.GetMoves<kNonQuiescent>();
+      MoveList moves = context.sampled_board.GetMoves<kNonQuiescent>();
       for (int depth = 1; depth <= max_depth; depth++) {
         Score max_dif = kMinScore;
         Score max_forcing_dif = kMinScore;
@@ -1344,19 +2354,19 @@ void EvaluateScoreDistributions(const int focus) {
           if (GetMoveType(move) >= kEnPassant) {
             forcing = true;
           }
-          sampled_board.Make(move);
-          if (sampled_board.InCheck()) {
+          context.sampled_board.Make(move);
+          if (context.sampled_board.InCheck()) {
             forcing = true;
           }
           Score ab_score = 0;
           if (depth == 1) {
-            ab_score = -QSearch(sampled_board);
+            ab_score = -QSearch(context.sampled_board);
           }
           else {
-            DepthSearch(sampled_board, depth - 1);
+            DepthSearch(context.sampled_board, depth - 1);
             ab_score = -get_last_search_score();
           }
-          sampled_board.UnMake();
+          context.sampled_board.UnMake();
 
           if (forcing) {
             max_forcing_dif = std::max(ab_score - score, max_forcing_dif);
@@ -33,21 +33,111 @@
 
 #include "board.h"
 #include "general/types.h"
+#include <atomic>
+#include <vector>
 
 namespace search {
 
+const size_t kMaxPVLength = 128;
+
+//Parallel search modes. Lazy SMP helpers run independent searches which only
+//share the transposition table. YBWC helpers idle until a node whose first
+//move has been searched hands its remaining moves out to them.
+const int kLazySMP = 0;
+const int kYBWC = 1;
+
+struct SplitPoint;
+
+//Id of contexts owned by callers of the single threaded searches, which never
+//report info.
+const int kCallerContextId = -1;
+
+//All state owned by a single search thread. Searches which use different
+//contexts are independent of each other and may run concurrently, they only
+//share the transposition table.
+struct SearchContext {
+  SearchContext(const int id = kCallerContextId);
+  void clear_killers();
+  void clear_history();
+  void end_search();
+  //Sets the time at which the search stops and clears a previous stop.
+  void set_end_time(const Time time);
+
+  //Id within the engine's contexts. Only the context with id 0 reports info.
+  int id;
+  //Options of the search this context takes part in. Engine searches set them
+  //from the engine options, other searches run single threaded with one line.
+  int smp_mode;
+  bool defer_moves;
+  size_t num_pv_lines;
+  //Helper contexts which are stopped and accounted for together with this one.
+  std::vector<SearchContext*> helpers;
+  Array2d<Move, 1024, 2> killers;
+  //Move ordering statistics gathered from cutoffs. Quiet moves are indexed by
+  //color, source and destination, captures by moving piece type, destination
+  //and captured piece type. Countermoves are indexed by the piece and the
+  //destination of the previous move.
+  std::array<Array2d<int32_t, 64, 64>, 2> history;
+  std::array<Array2d<int32_t, 64, kNumPieceTypes>, kNumPieceTypes - 1> capture_history;
+  Array2d<Move, 16, 64> counter_moves;
+  //Static evaluation by number of made moves, kNoStaticEval if not computed.
+  std::array<Score, 1024> static_evals;
+  //Triangular PV table. Row i holds the principal variation found below the
+  //node i plies from the root, so row 0 is the PV of the last iteration.
+  Array2d<Move, kMaxPVLength, kMaxPVLength> pv;
+  std::array<size_t, kMaxPVLength> pv_length;
+  size_t root_ply;
+  //Innermost YBWC split point this context is searching moves of, if any.
+  SplitPoint *split_point;
+  //Split point a YBWC worker has been handed, guarded by the split mutex.
+  SplitPoint *assigned_split_point;
+  std::atomic<size_t> max_ply;
+  std::atomic<long> nodes;
+  std::atomic<Time> end_time;
+  //Set once the search has to stop, either by end_search or because the end
+  //time has passed. The clock is only polled every few thousand nodes.
+  std::atomic<bool> stopped;
+  Score last_search_score;
+
+  //Sampling state used by the search parameter training routines.
+  long sample_nodes;
+  long evaluation_nodes;
+  Board sampled_board;
+  Score sampled_alpha;
+  int sampled_node_type;
+  Depth sampled_depth;
+};
+
 uint64_t Perft(Board &board, Depth depth);
+//The following searches run on the engine's own contexts, using Lazy SMP if
+//more than one thread has been set.
 Move DepthSearch(Board board, Depth depth);
 Move TimeSearch(Board board, Milliseconds time);
+//Sets the end time of the next engine search and clears an earlier stop. The
+//search itself is started with Search, which keeps both, so a stop sent in
+//between is not lost.
+void set_end_time(const Time end_time);
+Move Search(Board board, Depth depth);
+//Single threaded searches on a caller owned context. They do not report info
+//and may run concurrently with each other and with engine searches.
+Move DepthSearch(SearchContext &context, Board board, Depth depth);
+Move TimeSearch(SearchContext &context, Board board, Milliseconds time);
 Board SampleEval(Board board);
 Score QSearch(Board &board);
-void inc_node_count();
-void dec_node_count();
+Score QSearch(SearchContext &context, Board &board);
 Score get_last_search_score();
+//Number of nodes searched by all threads in the last engine search.
+long get_last_search_nodes();
 void set_print_info(bool print_info);
+void set_num_threads(const size_t num_threads);
+void set_smp_mode(const int smp_mode);
+//Sets how many of the best root moves are searched with exact scores and
+//reported as separate lines by the main thread.
+void set_num_pv_lines(const size_t num_lines);
 void end_search();
 
 void clear_killers();
+void clear_history();
 
 void CreateSearchParamDataset(bool from_scratch);
 void TrainSearchParams(bool from_scratch);
@@ -26,6 +26,18 @@
 
 #include "transposition.h"
 #include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <fstream>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace {
 
@@ -33,6 +45,10 @@ bool is_mate_score(const Score score) {
   return (score < kMinScore + 2000) || (score > kMaxScore - 2000);
 }
 
+uint32_t get_key(const HashType hash) {
+  return hash & 0xFFFFFFFF;
+}
+
 Score score_to_tt_score(const Score score, const size_t num_made_moves) {
   if (is_mate_score(score)) {
     if (score < 0) {
@@ -43,6 +59,33 @@ Score score_to_tt_score(const Score score, const size_t num_made_moves) {
   return score;
 }
 
+//Scores are stored in 16 bits. Mate scores keep their exact distance to mate,
+//all other scores are clamped to the remaining range.
+const Score kMateRange = 2000;
+const Score kMaxPackedScore = 32767;
+const Score kMaxPackedNonMateScore = kMaxPackedScore - kMateRange;
+const int16_t kNoPackedStaticEval = -kMaxPackedScore - 1;
+
+int16_t pack_score(const Score score) {
+  if (score > kMaxScore - kMateRange) {
+    return score - kMaxScore + kMaxPackedScore;
+  }
+  if (score < kMinScore + kMateRange) {
+    return score - kMinScore - kMaxPackedScore;
+  }
+  return std::max(std::min(score, kMaxPackedNonMateScore), -kMaxPackedNonMateScore);
+}
+
+Score unpack_score(const int16_t score) {
+  if (score > kMaxPackedNonMateScore) {
+    return score - kMaxPackedScore + kMaxScore;
+  }
+  if (score < -kMaxPackedNonMateScore) {
+    return score + kMaxPackedScore + kMinScore;
+  }
+  return score;
+}
+
 Score tt_score_to_score(Score score, size_t num_made_moves) {
   if (is_mate_score(score)) {
     if (score < 0) {
@@ -57,88 +100,441 @@ Score tt_score_to_score(Score score, size_t num_made_moves) {
 
 namespace table {
 
-int size = 1600000;
-int size_pvt = 10001;
-std::vector<Entry> table(size);
-std::vector<PVEntry> table_pv(size_pvt);
+//The table is shared by all search threads and accessed without locks. Every
+//entry is stored as three 32 bit words which are read and written atomically,
+//the first of which is the key xored with the other two.
+const size_t kEntryWords = sizeof(Entry) / sizeof(uint32_t);
+
+struct AtomicEntry {
+  std::atomic<uint32_t> words[kEntryWords];
+};
+
+//Entries are grouped into clusters which fill exactly one cache line, so a
+//probe touches a single line of memory.
+const size_t kCacheLineSize = 64;
+const size_t kClusterSize = kCacheLineSize / sizeof(AtomicEntry);
+
+struct alignas(kCacheLineSize) Cluster {
+  AtomicEntry entries[kClusterSize];
+};
+
+static_assert(sizeof(AtomicEntry) == sizeof(Entry), "Atomic entries must not add padding.");
+static_assert(sizeof(Cluster) == kCacheLineSize, "A cluster must fill one cache line.");
+
+size_t num_clusters = 0;
+Cluster *table = nullptr;
+const uint8_t kGenerationMask = 0x3F;
+std::atomic<uint8_t> generation(0);
+//ClearTable does not touch the table, instead it starts a new generation and
+//all entries written before it are considered stale. Generations wrap around,
+//so once stale entries could no longer be told apart from new ones they are
+//treated as ordinary old entries. They are still verified by their hash.
+//Searches on caller owned contexts may start new generations concurrently.
+std::atomic<uint8_t> clear_generation(0);
+std::atomic<bool> stale_entries(false);
+std::atomic<size_t> generations_since_zeroed(0);
+
+void ResetGenerations() {
+  generation.store(0, std::memory_order_relaxed);
+  clear_generation.store(0, std::memory_order_relaxed);
+  stale_entries.store(false, std::memory_order_relaxed);
+  generations_since_zeroed.store(0, std::memory_order_relaxed);
+}
+
+void ZeroTable();
+
+//Large tables are backed by huge pages where the OS supports it, which saves
+//most TLB misses during search. Otherwise we fall back to the heap.
+const size_t kHugePageSize = 2 << 20;
+void *table_memory = nullptr;
+size_t table_memory_bytes = 0;
+bool table_memory_mapped = false;
+
+void FreeTableMemory() {
+#ifdef __linux__
+  if (table_memory_mapped) {
+    munmap(table_memory, table_memory_bytes);
+  }
+#endif
+  if (!table_memory_mapped) {
+    delete[] static_cast<char*>(table_memory);
+  }
+  table_memory = nullptr;
+  table_memory_bytes = 0;
+  table_memory_mapped = false;
+  table = nullptr;
+}
+
+void AllocateHeapTableMemory(const size_t bytes) {
+  //std::allocator does not guarantee cache line alignment, so we align manually.
+  table_memory_bytes = bytes + kCacheLineSize;
+  table_memory = new char[table_memory_bytes];
+  size_t offset = reinterpret_cast<uintptr_t>(table_memory) % kCacheLineSize;
+  table = reinterpret_cast<Cluster*>(static_cast<char*>(table_memory)
+                                     + (kCacheLineSize - offset) % kCacheLineSize);
+}
+
+void AllocateTableMemory(const size_t bytes) {
+  FreeTableMemory();
+#ifdef __linux__
+  table_memory_bytes = (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  table_memory = mmap(nullptr, table_memory_bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (table_memory == MAP_FAILED) {
+    //No reserved huge pages, ask for transparent huge pages instead.
+    table_memory = mmap(nullptr, table_memory_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (table_memory != MAP_FAILED) {
+      madvise(table_memory, table_memory_bytes, MADV_HUGEPAGE);
+    }
+#endif
+  }
+  if (table_memory != MAP_FAILED) {
+    table_memory_mapped = true;
+    table = static_cast<Cluster*>(table_memory);
+    return;
+  }
+#endif
+  AllocateHeapTableMemory(bytes);
+}
 
 void SetTableSize(const long MB) {
-  size = (MB << 20) / 21;
-  size_pvt = size / 12;
-  table.resize(size);
-  table_pv.resize(size_pvt);
+  const size_t bytes = ((size_t) MB) << 20;
+  num_clusters = std::max(bytes / sizeof(Cluster), (size_t) 1);
+  AllocateTableMemory(num_clusters * sizeof(Cluster));
+  //Fresh anonymous mappings are zeroed by the OS already. Writing them here
+  //would fault in and commit every page before the first search.
+  if (table_memory_mapped) {
+    ResetGenerations();
+  }
+  else {
+    ZeroTable();
+  }
 }
 
-int HashFunction(const HashType hash) {
-  return hash % size;
+//Maps a hash uniformly onto [0, size) with a multiplication instead of a modulo.
+inline size_t ScaleHash(const HashType hash, const size_t size) {
+  return (((unsigned __int128) hash) * size) >> 64;
 }
 
-int PVHashFunction(const HashType hash) {
-  return hash % size_pvt;
+inline Cluster &GetCluster(const HashType hash) {
+  return table[ScaleHash(hash, num_clusters)];
 }
 
-Entry GetEntry(const HashType hash) {
-  Entry entry = table.at(HashFunction(hash));
-  return entry;
+inline uint32_t Checksum(const uint32_t words[kEntryWords]) {
+  uint32_t checksum = 0;
+  for (size_t i = 1; i < kEntryWords; i++) {
+    checksum ^= words[i];
+  }
+  return checksum;
 }
 
-PVEntry GetPVEntry(const HashType hash) {
-  PVEntry entry = table_pv.at(PVHashFunction(hash));
+inline Entry Load(const AtomicEntry &atomic_entry) {
+  uint32_t words[kEntryWords];
+  for (size_t i = 0; i < kEntryWords; i++) {
+    words[i] = atomic_entry.words[i].load(std::memory_order_relaxed);
+  }
+  Entry entry;
+  std::memcpy(&entry, words, sizeof(Entry));
   return entry;
 }
 
-void SaveEntry(const Board &board, const Move best_move, const Score score, const int bound,
-    const Depth depth) {
-  HashType hash = board.get_hash();
-  int index = HashFunction(hash);
+inline void Store(AtomicEntry &atomic_entry, const Entry &entry) {
+  uint32_t words[kEntryWords];
+  std::memcpy(words, &entry, sizeof(Entry));
+  for (size_t i = 0; i < kEntryWords; i++) {
+    atomic_entry.words[i].store(words[i], std::memory_order_relaxed);
+  }
+}
+
+inline bool IsStale(const uint8_t entry_generation) {
+  if (!stale_entries.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  const uint8_t current = generation.load(std::memory_order_relaxed);
+  return ((current - entry_generation) & kGenerationMask)
+          > ((current - clear_generation.load(std::memory_order_relaxed)) & kGenerationMask);
+}
+
+Entry GetEntry(const HashType hash) {
+  const Cluster &cluster = GetCluster(hash);
+  for (size_t i = 0; i < kClusterSize; i++) {
+    Entry entry = Load(cluster.entries[i]);
+    if (ValidateHash(entry, hash) && !IsStale(entry.get_generation())) {
+      return entry;
+    }
+  }
+  Entry empty = Entry();
+  empty.key = ~get_key(hash);
+  return empty;
+}
+
+void Prefetch(const HashType hash) {
+  __builtin_prefetch(&GetCluster(hash));
+}
 
-  assert(index >= 0 && index < table.size());
+//Markers replace the lowest byte of the hash by the depth.
+const size_t kNumSearchingMarkers = 1 << 12;
+std::atomic<HashType> searching_markers[kNumSearchingMarkers];
 
-  HashType best_move_cast = best_move;
-  table[index].hash = hash ^ best_move_cast;
-  table[index].best_move = best_move;
-  table[index].set_score(score, board);
-  table[index].bound = bound;
-  table[index].depth = depth;
+inline HashType GetSearchingMarker(const HashType hash, const Depth depth) {
+  return (hash & ~((HashType) 0xFF)) | (depth & 0xFF);
 }
 
-void SavePVEntry(const Board &board, const Move best_move) {
+inline std::atomic<HashType> &GetSearchingSlot(const HashType hash) {
+  return searching_markers[(hash >> 8) & (kNumSearchingMarkers - 1)];
+}
+
+void StartSearching(const HashType hash, const Depth depth) {
+  GetSearchingSlot(hash).store(GetSearchingMarker(hash, depth), std::memory_order_relaxed);
+}
+
+void FinishSearching(const HashType hash, const Depth depth) {
+  HashType marker = GetSearchingMarker(hash, depth);
+  GetSearchingSlot(hash).compare_exchange_strong(marker, 0, std::memory_order_relaxed);
+}
+
+bool IsBeingSearched(const HashType hash, const Depth depth) {
+  return GetSearchingSlot(hash).load(std::memory_order_relaxed)
+      == GetSearchingMarker(hash, depth);
+}
+
+//The entry with the lowest value is the first to be replaced. Entries lose
+//value with every search generation that has passed since they were written.
+inline int ReplacementValue(const Entry &entry) {
+  if (IsStale(entry.get_generation())) {
+    return -kMaxScore;
+  }
+  const uint8_t age = (generation.load(std::memory_order_relaxed) - entry.get_generation())
+                      & kGenerationMask;
+  return entry.get_depth() - 4 * age;
+}
+
+void SaveEntry(const Board &board, const Move best_move, const Score score, const int bound,
+    const Depth depth, Score static_eval) {
   HashType hash = board.get_hash();
-  int index = PVHashFunction(hash);
-  assert(index >= 0 && index < table_pv.size());
-  HashType best_move_cast = best_move;
-  table_pv[index].hash = hash ^ best_move_cast;
-  table_pv[index].best_move = best_move;
+  Cluster &cluster = GetCluster(hash);
+  size_t replace = 0;
+  int replace_value = 0;
+  for (size_t i = 0; i < kClusterSize; i++) {
+    Entry entry = Load(cluster.entries[i]);
+    if (ValidateHash(entry, hash) && !IsStale(entry.get_generation())) {
+      replace = i;
+      if (static_eval == kNoStaticEval) {
+        static_eval = entry.get_static_eval();
+      }
+      break;
+    }
+    if (i == 0 || ReplacementValue(entry) < replace_value) {
+      replace = i;
+      replace_value = ReplacementValue(entry);
+    }
+  }
+
+  Entry entry = Entry();
+  entry.best_move = best_move;
+  entry.set_score(score, board);
+  entry.set_bound_and_generation(bound, generation.load(std::memory_order_relaxed));
+  entry.set_depth(depth);
+  entry.set_static_eval(static_eval);
+  uint32_t words[kEntryWords];
+  std::memcpy(words, &entry, sizeof(Entry));
+  entry.key = get_key(hash) ^ Checksum(words);
+  Store(cluster.entries[replace], entry);
 }
 
 bool ValidateHash(const Entry &entry, const HashType hash){
-  HashType best_move_cast = entry.best_move;
-  return entry.hash == (hash ^ best_move_cast);
+  uint32_t words[kEntryWords];
+  std::memcpy(words, &entry, sizeof(Entry));
+  return entry.key == (get_key(hash) ^ Checksum(words));
 }
 
-bool ValidateHash(const PVEntry &entry, const HashType hash){
-  HashType best_move_cast = entry.best_move;
-  return entry.hash == (hash ^ best_move_cast);
+
+//Zeroing a table of many GB is bound by page faults and memory bandwidth, so
+//the work is split over all available cores.
+const size_t kMinBytesPerZeroingThread = 64 << 20;
+
+void ZeroTableRange(const size_t thread_id, const size_t num_threads) {
+  const size_t cluster_begin = num_clusters * thread_id / num_threads;
+  const size_t cluster_end = num_clusters * (thread_id + 1) / num_threads;
+  std::memset(static_cast<void*>(table + cluster_begin), 0,
+              (cluster_end - cluster_begin) * sizeof(Cluster));
 }
 
+void ZeroTable() {
+  const size_t bytes = num_clusters * sizeof(Cluster);
+  const size_t num_threads = std::max(std::min((size_t) std::thread::hardware_concurrency(),
+                                               bytes / kMinBytesPerZeroingThread), (size_t) 1);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(ZeroTableRange, i, num_threads);
+  }
+  ZeroTableRange(0, num_threads);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  ResetGenerations();
+}
+
+//Table files start with a header padded to a page, so that the clusters stay
+//cache line aligned when the file is memory mapped. The clusters follow as
+//they are laid out in memory.
+const char kTableFileMagic[8] = { 'W', 'i', 'n', 't', 'e', 'r', 'T', 'T' };
+//Has to be increased whenever the layout of entries or clusters changes.
+const uint32_t kTableFileVersion = 3;
+const size_t kTableFileHeaderSize = 4096;
+
+struct TableFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t cluster_size;
+  HashType keys_signature;
+  uint64_t num_clusters;
+  uint64_t generations_since_zeroed;
+  uint8_t generation;
+  uint8_t clear_generation;
+  uint8_t stale_entries;
+};
+
+static_assert(sizeof(TableFileHeader) <= kTableFileHeaderSize, "Table file header is too large.");
+
+bool SaveTable(const std::string &file_name) {
+  //The table may be a mapping of the target file, which must not be truncated
+  //while we read from it. So we write a temporary file and replace the target.
+  const std::string temp_file_name = file_name + ".tmp";
+  std::ofstream file(temp_file_name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  TableFileHeader header = TableFileHeader();
+  std::memcpy(header.magic, kTableFileMagic, sizeof(kTableFileMagic));
+  header.version = kTableFileVersion;
+  header.cluster_size = sizeof(Cluster);
+  header.keys_signature = hash::GetKeysSignature();
+  header.num_clusters = num_clusters;
+  header.generations_since_zeroed = generations_since_zeroed.load(std::memory_order_relaxed);
+  header.generation = generation.load(std::memory_order_relaxed);
+  header.clear_generation = clear_generation.load(std::memory_order_relaxed);
+  header.stale_entries = stale_entries.load(std::memory_order_relaxed);
+  std::vector<char> header_page(kTableFileHeaderSize, 0);
+  std::memcpy(header_page.data(), &header, sizeof(header));
+  file.write(header_page.data(), kTableFileHeaderSize);
+  file.write(reinterpret_cast<const char*>(table), num_clusters * sizeof(Cluster));
+  file.close();
+  if (!file || std::rename(temp_file_name.c_str(), file_name.c_str()) != 0) {
+    std::remove(temp_file_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool LoadTable(const std::string &file_name) {
+  std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  const size_t file_size = file.tellg();
+  TableFileHeader header;
+  file.seekg(0);
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+      || std::memcmp(header.magic, kTableFileMagic, sizeof(kTableFileMagic)) != 0
+      || header.version != kTableFileVersion || header.cluster_size != sizeof(Cluster)
+      || header.keys_signature != hash::GetKeysSignature()
+      || header.num_clusters == 0) {
+    return false;
+  }
+  const size_t table_bytes = header.num_clusters * sizeof(Cluster);
+  if (file_size != kTableFileHeaderSize + table_bytes) {
+    return false;
+  }
+
+  FreeTableMemory();
+  num_clusters = header.num_clusters;
+#ifdef __linux__
+  //A private mapping lets the search write to the table without ever
+  //modifying the file.
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    table_memory_bytes = kTableFileHeaderSize + table_bytes;
+    table_memory = mmap(nullptr, table_memory_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (table_memory != MAP_FAILED) {
+      table_memory_mapped = true;
+      table = reinterpret_cast<Cluster*>(static_cast<char*>(table_memory)
+                                         + kTableFileHeaderSize);
+    }
+    else {
+      table_memory = nullptr;
+    }
+  }
+#endif
+  if (!table_memory_mapped) {
+    AllocateHeapTableMemory(table_bytes);
+    file.seekg(kTableFileHeaderSize);
+    if (!file.read(reinterpret_cast<char*>(table), table_bytes)) {
+      ZeroTable();
+      return false;
+    }
+  }
+  generation.store(header.generation & kGenerationMask, std::memory_order_relaxed);
+  clear_generation.store(header.clear_generation & kGenerationMask, std::memory_order_relaxed);
+  stale_entries.store(header.stale_entries, std::memory_order_relaxed);
+  generations_since_zeroed.store(header.generations_since_zeroed, std::memory_order_relaxed);
+  return true;
+}
 
 void ClearTable() {
-  for (unsigned int i = 0; i < table.size(); i++) {
-    table[i].hash = 0;
-    table[i].best_move = 0;
+  IncrementGeneration();
+  if (generations_since_zeroed.load(std::memory_order_relaxed) > 0) {
+    clear_generation.store(generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    stale_entries.store(true, std::memory_order_relaxed);
   }
-  for (unsigned int i = 0; i < table_pv.size(); i++) {
-    table_pv[i].hash = 0;
-    table_pv[i].best_move = 0;
+}
+
+void IncrementGeneration() {
+  uint8_t current = generation.load(std::memory_order_relaxed);
+  while (!generation.compare_exchange_weak(current, (current + 1) & kGenerationMask,
+                                           std::memory_order_relaxed)) {}
+  const uint8_t next = (current + 1) & kGenerationMask;
+  generations_since_zeroed.fetch_add(1, std::memory_order_relaxed);
+  if (((next - clear_generation.load(std::memory_order_relaxed)) & kGenerationMask)
+      >= kGenerationMask) {
+    stale_entries.store(false, std::memory_order_relaxed);
   }
 }
 
 void Entry::set_score(const Score score_new, const Board &board) {
-  score = score_to_tt_score(score_new, board.get_num_made_moves());
+  score = pack_score(score_to_tt_score(score_new, board.get_num_made_moves()));
 }
 
 Score Entry::get_score(const Board &board) const {
-  return tt_score_to_score(score, board.get_num_made_moves());
+  return tt_score_to_score(unpack_score(score), board.get_num_made_moves());
+}
+
+Score Entry::get_static_eval() const {
+  if (static_eval == kNoPackedStaticEval) {
+    return kNoStaticEval;
+  }
+  return static_eval;
+}
+
+void Entry::set_static_eval(const Score new_static_eval) {
+  if (new_static_eval == kNoStaticEval) {
+    static_eval = kNoPackedStaticEval;
+    return;
+  }
+  static_eval = std::max(std::min(new_static_eval, kMaxPackedNonMateScore),
+                         -kMaxPackedNonMateScore);
+}
+
+void Entry::set_bound_and_generation(const int bound, const uint8_t generation) {
+  bound_generation = bound | (generation << 2);
+}
+
+void Entry::set_depth(const Depth new_depth) {
+  depth = std::max(std::min(new_depth, 255), 0);
 }
 
 
@@ -29,34 +29,65 @@
 
 #include "general/types.h"
 #include "board.h"
+#include <string>
 
 namespace table {
 
+//Entries are packed into 12 bytes. Only the lower 32 bits of the hash are
+//stored, the upper bits are implied by the cluster an entry resides in.
+//In the table the key is further xored with the remaining data, so that
+//entries torn by concurrent writers fail validation.
 struct Entry {
-  HashType hash;
-  Move best_move;
-  int bound;
-  Depth depth;
+  uint32_t key;
+  uint16_t best_move;
+  int get_bound() const { return bound_generation & 0x3; }
+  Depth get_depth() const { return depth; }
+  uint8_t get_generation() const { return bound_generation >> 2; }
   Score get_score(const Board &board) const;
   void set_score(const Score new_score, const Board &board);
+  //Returns kNoStaticEval if the entry was saved without a static evaluation.
+  Score get_static_eval() const;
+  void set_static_eval(const Score new_static_eval);
+  void set_bound_and_generation(const int bound, const uint8_t generation);
+  void set_depth(const Depth new_depth);
 private:
-  Score score;
+  int16_t score;
+  uint8_t depth;
+  //Lowest 2 bits hold the bound, the rest the search generation.
+  uint8_t bound_generation;
+  int16_t static_eval;
 };
 
-struct PVEntry {
-  HashType hash;
-  Move best_move;
-};
+static_assert(sizeof(Entry) == 12, "TT entries are expected to be packed into 12 bytes.");
 
 void SetTableSize(const long MB);
 Entry GetEntry(const HashType hash);
+//Hints the CPU to load the cluster of the hash into cache. Should be issued
+//as early as possible before the corresponding GetEntry.
+void Prefetch(const HashType hash);
+//Entries may be saved with kNoBound to only store a static evaluation. If no
+//static evaluation is given, the one of an existing entry is kept.
 void SaveEntry(const Board &board, const Move best_move, const Score score, const int bound,
-    const Depth depth);
+    const Depth depth, const Score static_eval = kNoStaticEval);
 bool ValidateHash(const Entry &entry, const HashType hash);
-PVEntry GetPVEntry(const HashType hash);
-void SavePVEntry(const Board &board, const Move best_move);
-bool ValidateHash(const PVEntry &entry, const HashType hash);
+//Writes the table to a file which can later be loaded with LoadTable.
+bool SaveTable(const std::string &file_name);
+//Replaces the table by the one stored in the file. Where possible the file is
+//memory mapped, so entries are only read from disk once they are accessed.
+//Files written with different hash keys or entry layout are rejected.
+bool LoadTable(const std::string &file_name);
+//ABDADA style coordination of threads searching the same tree. A position is
+//marked while some thread searches it at the given depth, so that other
+//threads can defer it. Markers may be lost on collisions, which only costs
+//parallel efficiency.
+void StartSearching(const HashType hash, const Depth depth);
+void FinishSearching(const HashType hash, const Depth depth);
+bool IsBeingSearched(const HashType hash, const Depth depth);
+//Invalidates all entries in constant time by starting a new generation.
 void ClearTable();
+//Should be called at the start of every search. Entries from older
+//generations are replaced first.
+void IncrementGeneration();
 
 }
 
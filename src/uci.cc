@@ -33,11 +33,14 @@
 #include "search.h"
 #include "transposition.h"
 #include "general/debug.h"
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 #include <sstream>
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace {
 
@@ -63,6 +66,12 @@ const std::string kEngineAuthorPrefix = "id author ";
 const std::string kOk = "uciok";
 const std::string kUCIHashOptionString =
     "option name Hash type spin default 32 min 1 max 104576";
+const std::string kUCIThreadsOptionString =
+    "option name Threads type spin default 1 min 1 max 512";
+const std::string kUCIMultiPVOptionString =
+    "option name MultiPV type spin default 1 min 1 max 256";
+const std::string kUCISMPModeOptionString =
+    "option name SMPMode type combo default LazySMP var LazySMP var YBWC";
 
 struct Timer {
   Timer() {
@@ -82,25 +91,119 @@ int maxtime(int time) {
   return std::max((8 * time) / 10, time - 100);
 }
 
-void Go(Board *board, Timer timer) {
-  Move move = 0;
+//Makes the legal move matching the move string, if there is one.
+void MakeMove(Board &board, const std::string &move_string) {
+  Move move = parse::StringToMove(move_string);
+  MoveList moves = board.GetMoves<kNonQuiescent>();
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    if (GetMoveSource(moves[i]) == GetMoveSource(move)
+        && GetMoveDestination(moves[i]) == GetMoveDestination(move)
+        && (GetMoveType(moves[i]) < kKnightPromotion
+            || GetMoveType(moves[i]) == GetMoveType(move))) {
+      board.Make(moves[i]);
+      return;
+    }
+  }
+}
+
+Depth get_search_depth(const Timer &timer) {
+  if (timer.search_depth != 0) {
+    return timer.search_depth;
+  }
+  return 1000;
+}
+
+Time get_end_time(const Board &board, Timer timer) {
   if (timer.search_depth != 0) {
-    move = search::DepthSearch((*board), timer.search_depth);
+    return now() + std::chrono::hours(24);
   }
   else if (timer.movetime != 0) {
-    Milliseconds duration = Milliseconds(maxtime(timer.movetime));
-    move = search::TimeSearch((*board), duration);
+    return now() + Milliseconds(maxtime(timer.movetime));
+  }
+  if (timer.moves_to_go == 0) {
+    timer.moves_to_go = 40;
+  }
+  Color color = board.get_turn();
+  int time = (timer.time[color] / timer.moves_to_go) + timer.inc[color];
+  return now() + Milliseconds(maxtime(time));
+}
+
+//Searches run on a single long lived thread which waits for go requests.
+//Every request carries its own copy of the board, so commands received during
+//a search never touch the board being searched. Commands which change options,
+//the table or the evaluation stop the search first.
+class SearchThread {
+public:
+  SearchThread();
+  ~SearchThread();
+  //Stops a running search and starts a new one on a copy of the board.
+  void StartSearch(const Board &board, const Timer timer);
+  //Stops a running search and returns once its best move has been sent.
+  void StopSearch();
+
+private:
+  void Loop();
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  //True from the moment a search is requested until its best move is sent.
+  bool searching;
+  bool quit;
+  Board board;
+  Depth depth;
+  std::thread thread;
+};
+
+SearchThread::SearchThread() : searching(false), quit(false) {
+  thread = std::thread(&SearchThread::Loop, this);
+}
+
+SearchThread::~SearchThread() {
+  StopSearch();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  condition.notify_all();
+  thread.join();
+}
+
+void SearchThread::StartSearch(const Board &board_, const Timer timer) {
+  StopSearch();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    board.SetToSamePosition(board_);
+    depth = get_search_depth(timer);
+    //The end time is set before the search is woken up, so a stop received
+    //from now on cannot be cleared by the search.
+    search::set_end_time(get_end_time(board, timer));
+    searching = true;
+  }
+  condition.notify_all();
+}
+
+void SearchThread::StopSearch() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (searching) {
+    search::end_search();
+    condition.wait(lock, [this] { return !searching; });
   }
-  else {
-    if (timer.moves_to_go == 0) {
-      timer.moves_to_go = 40;
+}
+
+void SearchThread::Loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    condition.wait(lock, [this] { return quit || searching; });
+    if (quit) {
+      return;
     }
-    Color color = board->get_turn();
-    int time = (timer.time[color] / timer.moves_to_go) + timer.inc[color];
-    Milliseconds duration = Milliseconds(maxtime(time));
-    move = search::TimeSearch((*board), duration);
+    lock.unlock();
+    Move move = search::Search(board, depth);
+    std::cout << "bestmove " << parse::MoveToString(move) << std::endl;
+    lock.lock();
+    searching = false;
+    condition.notify_all();
   }
-  std::cout << "bestmove " << parse::MoveToString(move) << std::endl;
 }
 
 
@@ -119,6 +222,11 @@ void Reply(std::string message) {
 void Loop() {
   debug::EnterFunction(debug::kUci, "uci::Loop", "");
   Board board;
+  SearchThread search_thread;
+  //Root position and moves of the last position command. If the next command
+  //only appends moves, just those are made instead of replaying the game.
+  std::vector<std::string> position_root;
+  std::vector<std::string> position_moves;
   while (true) {
     std::string in;
     std::getline(std::cin, in);
@@ -126,9 +234,6 @@ void Loop() {
     unsigned int index = 0;
     std::string command = tokens[index++];
     if (Equals(command, "quit")) {
-      //Resynchronise search threads:
-      search::end_search();
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
       break;
     }
     else if (Equals(command, "isready")) {
@@ -157,65 +262,87 @@ void Loop() {
           + settings::engine_version);
       Reply(kEngineAuthorPrefix + settings::engine_author);
       Reply(kUCIHashOptionString);
+      Reply(kUCIThreadsOptionString);
+      Reply(kUCIMultiPVOptionString);
+      Reply(kUCISMPModeOptionString);
       Reply(kOk);
     }
     else if (Equals(command, "stop")) {
-      search::end_search();
+      search_thread.StopSearch();
+    }
+    else if (Equals(command, "ucinewgame")) {
+      search_thread.StopSearch();
+      table::ClearTable();
+      search::clear_killers();
+      search::clear_history();
     }
     else if (Equals(command, "setoption")) {
+      search_thread.StopSearch();
       index++;
       command = tokens[index++];
       if (Equals(command, "Hash")) {
         index++;
-        int MB = atoi(tokens[index++].c_str());
+        long MB = atol(tokens[index++].c_str());
         table::SetTableSize(MB);
       }
+      else if (Equals(command, "Threads")) {
+        index++;
+        int num_threads = atoi(tokens[index++].c_str());
+        search::set_num_threads(std::max(num_threads, 1));
+      }
+      else if (Equals(command, "MultiPV")) {
+        index++;
+        int num_lines = atoi(tokens[index++].c_str());
+        search::set_num_pv_lines(std::max(num_lines, 1));
+      }
+      else if (Equals(command, "SMPMode")) {
+        index++;
+        if (Equals(tokens[index++], "YBWC")) {
+          search::set_smp_mode(search::kYBWC);
+        }
+        else {
+          search::set_smp_mode(search::kLazySMP);
+        }
+      }
     }
     else if (Equals(command, "print_moves")) {
-      std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
+      MoveList moves = board.GetMoves<kNonQuiescent>();
       for (unsigned int i = 0; i < moves.size(); i++) {
         std::cout << parse::MoveToString(moves[i]) << std::endl;
       }
     }
     else if (Equals(command, "position")) {
+      std::vector<std::string> root, moves;
+      while (index < tokens.size() && !Equals(tokens[index], "moves")) {
+        root.emplace_back(tokens[index++]);
+      }
       if (index < tokens.size()) {
-        std::string arg = tokens[index++];
-        if (Equals(arg, "startpos")) {
-          board.SetStartBoard();
-          if (index < tokens.size()){
-            arg = tokens[index++];
-          }
-        }
-        else if (Equals(arg, "fen")) {
-          std::vector<std::string> fen_tokens;
-          while (index < tokens.size()) {
-            arg = tokens[index++];
-            if (Equals(arg, "moves")) {
-              break;
-            }
-            fen_tokens.emplace_back(arg);
-          }
-          board.SetBoard(fen_tokens);
-        }
-        if (Equals(arg, "moves")) {
-          while (index < tokens.size()) {
-            Move move = parse::StringToMove(tokens[index++]);
-            std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
-            for (unsigned int i = 0; i < moves.size(); i++) {
-              if (GetMoveSource(moves[i]) == GetMoveSource(move)
-                  && GetMoveDestination(moves[i]) == GetMoveDestination(move)
-                  && (GetMoveType(moves[i]) < kKnightPromotion
-                      || GetMoveType(moves[i]) == GetMoveType(move))) {
-                board.Make(moves[i]);
-                break;
-              }
-            }
-          }
-        }
+        moves.assign(tokens.begin() + index + 1, tokens.end());
+      }
+      bool extends_last = !root.empty() && root == position_root
+          && moves.size() >= position_moves.size()
+          && std::equal(position_moves.begin(), position_moves.end(),
+                        moves.begin());
+      size_t first_new_move = 0;
+      if (extends_last) {
+        first_new_move = position_moves.size();
+      }
+      else if (!root.empty() && Equals(root[0], "startpos")) {
+        board.SetStartBoard();
+      }
+      else if (!root.empty() && Equals(root[0], "fen")) {
+        board.SetBoard(std::vector<std::string>(root.begin() + 1, root.end()));
+      }
+      else {
+        continue;
       }
+      for (size_t i = first_new_move; i < moves.size(); i++) {
+        MakeMove(board, moves[i]);
+      }
+      position_root = root;
+      position_moves = moves;
     }
     else if (Equals(command, "go")) {
-      search::end_search();
       Timer timer;
       if (tokens.size() >= index+2) {
         while (tokens.size() >= index+2) {
@@ -250,8 +377,7 @@ void Loop() {
       else{
         timer.search_depth = 6;
       }
-      std::thread t(Go, &board, timer);
-      t.detach();
+      search_thread.StartSearch(board, timer);
     }
     else if (Equals(command, "see")) {
       Move move = parse::StringToMove(tokens[index]);
@@ -259,7 +385,7 @@ void Loop() {
     }
     else if (Equals(command, "perft")) {
       Depth depth = atoi(tokens[index++].c_str());
-      std::vector<Move> moves = board.GetMoves<kNonQuiescent>();
+      MoveList moves = board.GetMoves<kNonQuiescent>();
       uint64_t sum = 0;
       Time begin = now();
       HashType hash = board.get_hash();
@@ -281,15 +407,34 @@ void Loop() {
       }
     }
     else if (Equals(command, "estimate_variable_influence")) {
+      search_thread.StopSearch();
       evaluation::CheckVariableInfluence();
     }
     else if (Equals(command, "train_params")) {
+      search_thread.StopSearch();
       evaluation::Train(false);
     }
     else if (Equals(command, "perft_test")) {
       benchmark::PerftSuite();
     }
+    else if (Equals(command, "save_hash")) {
+      search_thread.StopSearch();
+      if (!table::SaveTable(tokens[index++])) {
+        debug::Error("Could not save hash table!", false);
+      }
+    }
+    else if (Equals(command, "load_hash")) {
+      search_thread.StopSearch();
+      if (!table::LoadTable(tokens[index++])) {
+        debug::Error("Could not load hash table!", false);
+      }
+    }
+    else if (Equals(command, "time_to_depth")) {
+      search_thread.StopSearch();
+      benchmark::TimeToDepthSuite();
+    }
     else if (Equals(command, "benchmark")) {
+      search_thread.StopSearch();
       int ms = atoi(tokens[index++].c_str());
       benchmark::EntropyLossTimedSuite(Milliseconds(ms));
     }